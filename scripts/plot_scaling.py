@@ -0,0 +1,38 @@
+# Plot the output of `benchmark scaling`: training time and memory against the number of rows.
+# Usage: python plot_scaling.py [scaling.csv]
+import csv
+import sys
+from collections import defaultdict
+
+import matplotlib.pyplot as plt
+
+filename = sys.argv[1] if len(sys.argv) > 1 else "scaling.csv"
+with open(filename) as f:
+    rows = list(csv.DictReader(f))
+
+train_time = defaultdict(list)
+for row in rows:
+    train_time[int(row["threads"])].append((int(row["rows"]), float(row["train_s"])))
+
+memory = {}
+for row in rows:
+    memory[int(row["rows"])] = float(row["peak_rss_mb"])
+
+fig, (time_ax, memory_ax) = plt.subplots(1, 2, figsize=(12, 5))
+for threads, points in sorted(train_time.items()):
+    points.sort()
+    time_ax.plot([p[0] for p in points], [p[1] for p in points], marker="o", label=f"{threads} threads")
+time_ax.set_xlabel("rows")
+time_ax.set_ylabel("train time per iteration (s)")
+time_ax.set_xscale("log")
+time_ax.set_yscale("log")
+time_ax.legend()
+
+row_counts = sorted(memory)
+memory_ax.plot(row_counts, [memory[r] for r in row_counts], marker="o")
+memory_ax.set_xlabel("rows")
+memory_ax.set_ylabel("peak RSS (MB)")
+memory_ax.set_xscale("log")
+
+fig.tight_layout()
+fig.savefig(filename.rsplit(".", 1)[0] + ".png")
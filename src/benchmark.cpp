@@ -0,0 +1,876 @@
+#include <iostream>
+#include <vector>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <random>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "data_preprocessing.hpp"
+#include "normalization.hpp"
+#include "plain_algorithms.hpp"
+#include "synthetic.hpp"
+#include "column_packing.hpp"
+#include "packing.hpp"
+#include "inference.hpp"
+#include "transport.hpp"
+#include "keystore.hpp"
+#include "cpu_features.hpp"
+using namespace std;
+using namespace seal;
+
+double ElapsedSeconds(chrono::high_resolution_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+// Compare the public-key Encrypt() path with the data owner's symmetric, seeded path
+// on every row of the training set: throughput and serialized bytes.
+void BenchmarkEncryption(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key, double scale,
+                         const vector<vector<double>> &features)
+{
+    cout << "[Encryption] " << features.size() << " rows" << endl;
+
+    vector<Plaintext> plain_rows(features.size());
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        vector<double> row = features[i];
+        Encode(encoder, row, scale, plain_rows[i]);
+    }
+
+    compr_mode_type compr_modes[] = {compr_mode_type::none, Serialization::compr_mode_default};
+    for (compr_mode_type compr_mode : compr_modes)
+    {
+        string compr_name = compr_mode == compr_mode_type::none ? "none" : "default";
+
+        // Public-key encryption, as done by Encrypt()
+        streamoff public_bytes = 0;
+        auto start = chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < plain_rows.size(); ++i)
+        {
+            Ciphertext ciphertext = Encrypt(context, public_key, scale, plain_rows[i]);
+            stringstream wire;
+            public_bytes += ciphertext.save(wire, compr_mode);
+        }
+        double public_time = ElapsedSeconds(start);
+
+        // Symmetric-key encryption with seed compression
+        streamoff symmetric_bytes = 0;
+        start = chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < plain_rows.size(); ++i)
+        {
+            stringstream wire;
+            symmetric_bytes += EncryptSymmetricToStream(context, secret_key, plain_rows[i], wire, compr_mode);
+        }
+        double symmetric_time = ElapsedSeconds(start);
+
+        cout << "  compression: " << compr_name << endl;
+        cout << "    public-key:    " << plain_rows.size() / public_time << " rows/s\t"
+             << public_bytes / plain_rows.size() << " bytes/row" << endl;
+        cout << "    symmetric-key: " << plain_rows.size() / symmetric_time << " rows/s\t"
+             << symmetric_bytes / plain_rows.size() << " bytes/row" << endl;
+    }
+    cout << endl;
+}
+
+// Resident set size of this process in bytes (Linux only, 0 elsewhere)
+size_t CurrentRSS()
+{
+    fstream fin;
+    fin.open("/proc/self/statm", ios::in);
+    size_t total_pages = 0, resident_pages = 0;
+    fin >> total_pages >> resident_pages;
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+size_t PeakRSS()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return size_t(usage.ru_maxrss) * 1024;
+}
+
+// Proportional set size of this process in bytes: every shared page counts 1 / (number of processes mapping it)
+// (Linux only, 0 elsewhere)
+size_t ProportionalSetSize()
+{
+    fstream fin;
+    fin.open("/proc/self/smaps_rollup", ios::in);
+    string line;
+    while (getline(fin, line))
+    {
+        if (line.rfind("Pss:", 0) == 0)
+        {
+            return stoul(line.substr(4)) * 1024;
+        }
+    }
+    return 0;
+}
+
+// Load, encrypt, train one iteration and compute the accuracy of synthetic datasets of increasing size,
+// training with 1, 2, 4, ... threads up to the number of cores.
+// One line per (rows, threads) is written to output_filename; scripts/plot_scaling.py plots it.
+void BenchmarkScaling(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key, RelinKeys &relin_keys,
+                      double scale, size_t feature_count, const vector<size_t> &row_counts, string output_filename)
+{
+    cout << "[Scaling] " << feature_count << " features" << endl;
+
+    vector<size_t> thread_counts;
+    for (size_t threads = 1; threads <= max(1u, thread::hardware_concurrency()); threads *= 2)
+    {
+        thread_counts.push_back(threads);
+    }
+
+    fstream fout;
+    fout.open(output_filename, ios::out);
+    fout << "rows,features,threads,load_s,encrypt_s,train_s,accuracy,rss_mb,peak_rss_mb,seal_pool_mb" << endl;
+
+    for (size_t row_count : row_counts)
+    {
+        string dataset_filename = "dataset/scaling.csv";
+        WriteDatasetToCSV(dataset_filename, SyntheticHeader(feature_count), GenerateDataset(row_count, feature_count, 0.5, 0));
+
+        auto start = chrono::high_resolution_clock::now();
+        auto features = ReadDatasetFromCSV(dataset_filename);
+        auto labels = ExtractLabel(features, feature_count + 1);
+        double load_time = ElapsedSeconds(start);
+
+        vector<double> weights(features[0].size(), 0);
+        start = chrono::high_resolution_clock::now();
+        vector<Ciphertext> encrypted_features, encrypted_labels, encrypted_products;
+        for (size_t i = 0; i < features.size(); ++i)
+        {
+            Plaintext plain_feature, plain_label, plain_product;
+            Encode(encoder, features[i], scale, plain_feature);
+            stringstream upload;
+            EncryptSymmetricToStream(context, secret_key, plain_feature, upload);
+            encrypted_features.push_back(LoadCiphertext(context, upload));
+
+            Encode(encoder, labels[i], scale, plain_label);
+            upload.str("");
+            upload.clear();
+            EncryptSymmetricToStream(context, secret_key, plain_label, upload);
+            encrypted_labels.push_back(LoadCiphertext(context, upload));
+
+            Encode(encoder, PlainVectorMultiplication(features[i], weights), scale, plain_product);
+            encrypted_products.push_back(Encrypt(context, public_key, scale, plain_product));
+        }
+        double encrypt_time = ElapsedSeconds(start);
+
+        Plaintext plain_weights, plain_learning_rate;
+        Encode(encoder, weights, scale, plain_weights);
+        Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+        Encode(encoder, 0.1, scale, plain_learning_rate);
+        Ciphertext encrypted_learning_rate = Encrypt(context, public_key, scale, plain_learning_rate);
+
+        vector<double> mask(features.size(), 1);
+        for (size_t threads : thread_counts)
+        {
+            start = chrono::high_resolution_clock::now();
+            Ciphertext encrypted_derivatives_sum = GradientSumParallel(context, relin_keys, scale, encrypted_products, encrypted_features,
+                                                                       encrypted_labels, mask, threads);
+            Ciphertext encrypted_trained_weights = UpdateWeight(context, relin_keys, scale, encrypted_derivatives_sum, features.size(),
+                                                                encrypted_weights, encrypted_learning_rate);
+            double train_time = ElapsedSeconds(start);
+
+            vector<double> trained_weights;
+            Plaintext plain_trained_weights = Decrypt(context, secret_key, encrypted_trained_weights);
+            Decode(encoder, plain_trained_weights, trained_weights);
+            trained_weights.resize(features[0].size());
+            double accuracy = ComputeAccuracy(features, labels, trained_weights);
+
+            double mb = 1024 * 1024;
+            fout << row_count << "," << feature_count << "," << threads << "," << load_time << "," << encrypt_time << ","
+                 << train_time << "," << accuracy << "," << CurrentRSS() / mb << "," << PeakRSS() / mb << ","
+                 << MemoryManager::GetPool().alloc_byte_count() / mb << endl;
+            cout << "  rows: " << row_count << "\tthreads: " << threads << "\tload: " << load_time << "s\tencrypt: " << encrypt_time
+                 << "s\ttrain: " << train_time << "s\taccuracy: " << accuracy << "\tRSS: " << CurrentRSS() / mb << " MB" << endl;
+        }
+    }
+    fout.close();
+    cout << "Results written to " << output_filename << endl
+         << endl;
+}
+
+// Average time of one Train call on the diabetes set.
+// Run it from a build with and without HELR_USE_HEXL / HELR_NATIVE_ARCH to compare kernels.
+void BenchmarkTrain(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, RelinKeys &relin_keys, GaloisKeys &galois_keys,
+                    double scale, vector<vector<double>> &features, vector<double> &labels, int iterations)
+{
+    cout << "[Train] " << features.size() << " rows, " << iterations << " iterations" << endl;
+    size_t slot_count = encoder.slot_count();
+    vector<double> weights(features[0].size(), 0.1);
+
+    vector<Ciphertext> encrypted_features, encrypted_labels, encrypted_products;
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        Plaintext plain_feature, plain_label, plain_product;
+        Encode(encoder, features[i], scale, plain_feature);
+        encrypted_features.push_back(Encrypt(context, public_key, scale, plain_feature));
+        Encode(encoder, labels[i], scale, plain_label);
+        encrypted_labels.push_back(Encrypt(context, public_key, scale, plain_label));
+        Encode(encoder, PlainVectorMultiplication(features[i], weights), scale, plain_product);
+        encrypted_products.push_back(Encrypt(context, public_key, scale, plain_product));
+    }
+    Plaintext plain_weights, plain_learning_rate;
+    Encode(encoder, weights, scale, plain_weights);
+    Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+    Encode(encoder, 0.1, scale, plain_learning_rate);
+    Ciphertext encrypted_learning_rate = Encrypt(context, public_key, scale, plain_learning_rate);
+
+    GradientWorkspace workspace(context);
+    double total_time = 0;
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        Train(context, relin_keys, galois_keys, scale, encrypted_products, encrypted_features, encrypted_labels, encrypted_weights,
+              encrypted_learning_rate, slot_count, workspace);
+        total_time += ElapsedSeconds(start);
+    }
+    cout << "  " << total_time / iterations << " s/iteration\t" << total_time / iterations / features.size() * 1000 << " ms/sample" << endl
+         << endl;
+}
+
+// One training iteration with one ciphertext per sample (Train) against one ciphertext per feature column (ColumnGradient)
+void BenchmarkLayouts(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key, RelinKeys &relin_keys,
+                      GaloisKeys &galois_keys, double scale, vector<vector<double>> &features, vector<double> &labels)
+{
+    cout << "[Layouts] " << features.size() << " rows x " << features[0].size() << " features" << endl;
+    size_t slot_count = encoder.slot_count();
+    vector<double> weights(features[0].size(), 0.1);
+    double learning_rate = 0.1;
+
+    // Row layout
+    auto start = chrono::high_resolution_clock::now();
+    vector<Ciphertext> encrypted_features, encrypted_labels, encrypted_products;
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        Plaintext plain_feature, plain_label, plain_product;
+        Encode(encoder, features[i], scale, plain_feature);
+        encrypted_features.push_back(Encrypt(context, public_key, scale, plain_feature));
+        Encode(encoder, labels[i], scale, plain_label);
+        encrypted_labels.push_back(Encrypt(context, public_key, scale, plain_label));
+        Encode(encoder, PlainVectorMultiplication(features[i], weights), scale, plain_product);
+        encrypted_products.push_back(Encrypt(context, public_key, scale, plain_product));
+    }
+    Plaintext plain_weights, plain_learning_rate;
+    Encode(encoder, weights, scale, plain_weights);
+    Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+    Encode(encoder, learning_rate, scale, plain_learning_rate);
+    Ciphertext encrypted_learning_rate = Encrypt(context, public_key, scale, plain_learning_rate);
+    double row_encrypt_time = ElapsedSeconds(start);
+
+    start = chrono::high_resolution_clock::now();
+    Train(context, relin_keys, galois_keys, scale, encrypted_products, encrypted_features, encrypted_labels, encrypted_weights,
+          encrypted_learning_rate, slot_count);
+    double row_train_time = ElapsedSeconds(start);
+
+    // Row layout with the label packed into the sample ciphertext
+    start = chrono::high_resolution_clock::now();
+    vector<Ciphertext> packed_samples;
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        vector<double> packed_sample = PackSampleWithLabel(features[i], labels[i]);
+        Plaintext plain_sample;
+        Encode(encoder, packed_sample, scale, plain_sample);
+        packed_samples.push_back(Encrypt(context, public_key, scale, plain_sample));
+    }
+    double packed_encrypt_time = ElapsedSeconds(start);
+
+    start = chrono::high_resolution_clock::now();
+    vector<double> all_samples(features.size(), 1);
+    Ciphertext label_term = LabelTerm(context, galois_keys, scale, packed_samples, all_samples, BlockSize(features[0].size()));
+    GradientWorkspace workspace(context);
+    Train(context, relin_keys, galois_keys, scale, encrypted_products, packed_samples, label_term, encrypted_weights,
+          encrypted_learning_rate, slot_count, workspace);
+    double packed_train_time = ElapsedSeconds(start);
+
+    // Column layout
+    start = chrono::high_resolution_clock::now();
+    ColumnDataset dataset = EncryptColumns(context, encoder, secret_key, scale, features, labels);
+    double column_encrypt_time = ElapsedSeconds(start);
+
+    start = chrono::high_resolution_clock::now();
+    ColumnGradient(context, relin_keys, galois_keys, scale, dataset, weights);
+    double column_train_time = ElapsedSeconds(start);
+
+    cout << "  rows:    " << encrypted_features.size() + encrypted_labels.size() + encrypted_products.size() + 2 << " ciphertexts\t"
+         << "encrypt: " << row_encrypt_time << "s\titeration: " << row_train_time << "s" << endl;
+    cout << "  packed:  " << packed_samples.size() + encrypted_products.size() + 2 << " ciphertexts\t"
+         << "encrypt: " << packed_encrypt_time << "s\titeration: " << packed_train_time << "s" << endl;
+    cout << "  columns: " << ColumnCiphertextCount(dataset) << " ciphertexts\t"
+         << "encrypt: " << column_encrypt_time << "s\titeration: " << column_train_time << "s" << endl
+         << endl;
+}
+
+// Reducing one row to its sum in slot 0: the log2(width) rotate-and-add steps Sum() uses for power-of-two widths,
+// and the rotations by steps 1 .. width - 1 it needs otherwise: one after the other with the default power-of-two keys,
+// one after the other with a key per step, and all at once with RotateMany and a key per step.
+void BenchmarkRotations(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, KeyGenerator &keygen, GaloisKeys &galois_keys,
+                        double scale, const vector<size_t> &widths)
+{
+    cout << "[Rotations] " << thread::hardware_concurrency() << " threads" << endl;
+    Evaluator evaluator(context);
+
+    for (size_t width : widths)
+    {
+        vector<double> row(width);
+        for (size_t i = 0; i < width; ++i)
+        {
+            row[i] = double(i + 1) / width;
+        }
+        Plaintext plain_row;
+        Encode(encoder, row, scale, plain_row);
+        Ciphertext encrypted_row = Encrypt(context, public_key, scale, plain_row);
+        vector<int> steps = RowRotationSteps(width);
+
+        auto start = chrono::high_resolution_clock::now();
+        GaloisKeys step_keys = CreateRotationKeys(keygen, steps);
+        double keygen_time = ElapsedSeconds(start);
+
+        Ciphertext rotated;
+        start = chrono::high_resolution_clock::now();
+        Ciphertext log_step_sum = encrypted_row;
+        for (size_t step = 1; step < width; step <<= 1)
+        {
+            evaluator.rotate_vector(log_step_sum, int(step), galois_keys, rotated);
+            evaluator.add_inplace(log_step_sum, rotated);
+        }
+        double log_step_time = ElapsedSeconds(start);
+
+        start = chrono::high_resolution_clock::now();
+        for (int step : steps)
+        {
+            evaluator.rotate_vector(encrypted_row, step, galois_keys, rotated);
+        }
+        double naive_time = ElapsedSeconds(start);
+
+        start = chrono::high_resolution_clock::now();
+        for (int step : steps)
+        {
+            evaluator.rotate_vector(encrypted_row, step, step_keys, rotated);
+        }
+        double step_keys_time = ElapsedSeconds(start);
+
+        start = chrono::high_resolution_clock::now();
+        vector<Ciphertext> rotations = RotateMany(context, step_keys, encrypted_row, steps, thread::hardware_concurrency());
+        double rotate_many_time = ElapsedSeconds(start);
+
+        cout << "  width " << width << ":\tlog-step sum (" << (width & (width - 1) ? "rounded up to a power of two" : "exact")
+             << "): " << log_step_time << "s\tpower-of-two keys: " << naive_time << "s\tkey per step: " << step_keys_time
+             << "s\tRotateMany: " << rotate_many_time << "s\t(key generation: " << keygen_time << "s)" << endl;
+    }
+    cout << endl;
+}
+
+// Encrypt the label-packed training set at the top level and at the level Train first uses it (SampleParmsId):
+// encryption time, bytes held in memory and seeded bytes on disk
+void BenchmarkSampleLevel(SEALContext &context, CKKSEncoder &encoder, SecretKey &secret_key, double scale,
+                          const vector<vector<double>> &features, const vector<double> &labels)
+{
+    cout << "[Sample level] " << features.size() << " label-packed rows" << endl;
+
+    parms_id_type levels[] = {context.first_parms_id(), SampleParmsId(context)};
+    for (parms_id_type parms_id : levels)
+    {
+        size_t memory_bytes = 0;
+        streamoff disk_bytes = 0;
+        auto start = chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < features.size(); ++i)
+        {
+            vector<double> packed_sample = PackSampleWithLabel(features[i], labels[i]);
+            Plaintext plain_sample;
+            Encode(encoder, packed_sample, parms_id, scale, plain_sample);
+            stringstream upload;
+            disk_bytes += EncryptSymmetricToStream(context, secret_key, plain_sample, upload);
+            Ciphertext sample = LoadCiphertext(context, upload);
+            memory_bytes += sample.size() * sample.poly_modulus_degree() * sample.coeff_modulus_size() * sizeof(uint64_t);
+        }
+        double encrypt_time = ElapsedSeconds(start);
+
+        cout << "  level " << context.get_context_data(parms_id)->chain_index() << ":\tencrypt: " << encrypt_time << "s\t"
+             << "memory: " << memory_bytes / (1024 * 1024) << " MB\tdisk: " << disk_bytes / (1024 * 1024) << " MB" << endl;
+    }
+    cout << endl;
+}
+
+// Score record_count encrypted records with plaintext, pre-encoded weights (multiply_plain)
+// and with encrypted weights (multiply and relinearize): latency per record and records per second
+void BenchmarkInference(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, KeyGenerator &keygen, RelinKeys &relin_keys,
+                        double scale, vector<vector<double>> &features, size_t record_count)
+{
+    record_count = min(record_count, features.size());
+    size_t width = features[0].size();
+    cout << "[Inference] " << record_count << " records" << endl;
+    GaloisKeys row_galois_keys = CreateRotationKeys(keygen, RowRotationSteps(width));
+
+    vector<Ciphertext> records;
+    for (size_t i = 0; i < record_count; ++i)
+    {
+        Plaintext plain_record;
+        Encode(encoder, features[i], scale, plain_record);
+        records.push_back(Encrypt(context, public_key, scale, plain_record));
+    }
+    vector<double> weights(width, 0.1);
+
+    auto start = chrono::high_resolution_clock::now();
+    PreparedModel model = PrepareModel(weights);
+    PreparedWeights(encoder, model, records[0].parms_id(), scale);
+    double prepare_time = ElapsedSeconds(start);
+
+    start = chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < record_count; ++i)
+    {
+        ScoreRecord(context, encoder, relin_keys, row_galois_keys, scale, records[i], model);
+    }
+    double plain_time = ElapsedSeconds(start);
+
+    Plaintext plain_weights;
+    Encode(encoder, weights, scale, plain_weights);
+    Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+    start = chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < record_count; ++i)
+    {
+        ScoreRecord(context, relin_keys, row_galois_keys, scale, records[i], encrypted_weights, width);
+    }
+    double encrypted_time = ElapsedSeconds(start);
+
+    cout << "  plaintext weights: " << plain_time / record_count * 1000 << " ms/record\t" << record_count / plain_time << " records/s"
+         << "\t(weights prepared once in " << prepare_time * 1000 << " ms)" << endl;
+    cout << "  encrypted weights: " << encrypted_time / record_count * 1000 << " ms/record\t" << record_count / encrypted_time << " records/s" << endl
+         << endl;
+}
+
+// The ciphertexts one training iteration exchanges, written uncompressed with Ciphertext::save, as before the
+// transport format, and in the transport format: bytes per iteration and serialize / deserialize time.
+// The client uploads a product per row and its weights, a worker returns a gradient sum (consumed at Level 1) and
+// the server returns the trained weights (consumed at Level 0). Every payload is encrypted at the top level, where
+// the flow produced it before the transport format, so the baseline pays for the primes its consumer drops.
+void BenchmarkTransport(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, double scale,
+                        const vector<vector<double>> &features)
+{
+    cout << "[Transport] one iteration over " << features.size() << " rows" << endl;
+    vector<double> weights(features[0].size(), 0.1);
+
+    // Every payload with the parms_id of its consumer
+    vector<Ciphertext> payloads;
+    vector<parms_id_type> consumer_parms_ids;
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        Plaintext plain_product;
+        Encode(encoder, PlainVectorMultiplication(features[i], weights), scale, plain_product);
+        payloads.push_back(Encrypt(context, public_key, scale, plain_product));
+        consumer_parms_ids.push_back(context.first_parms_id());
+    }
+    // Weights, gradient sum and trained weights
+    Plaintext plain_weights;
+    Encode(encoder, weights, scale, plain_weights);
+    for (parms_id_type consumer_parms_id : {context.last_parms_id(), GradientParmsId(context), context.last_parms_id()})
+    {
+        payloads.push_back(Encrypt(context, public_key, scale, plain_weights));
+        consumer_parms_ids.push_back(consumer_parms_id);
+    }
+
+    stringstream wire;
+    streamoff save_bytes = 0;
+    auto start = chrono::high_resolution_clock::now();
+    for (const Ciphertext &payload : payloads)
+    {
+        save_bytes += payload.save(wire, compr_mode_type::none);
+    }
+    double save_time = ElapsedSeconds(start);
+    start = chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < payloads.size(); ++i)
+    {
+        LoadCiphertext(context, wire);
+    }
+    double load_time = ElapsedSeconds(start);
+
+    wire.str("");
+    wire.clear();
+    streamoff transport_bytes = 0;
+    start = chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < payloads.size(); ++i)
+    {
+        transport_bytes += SaveTransport(context, payloads[i], consumer_parms_ids[i], wire);
+    }
+    double transport_save_time = ElapsedSeconds(start);
+    start = chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < payloads.size(); ++i)
+    {
+        LoadTransport(context, wire, consumer_parms_ids[i]);
+    }
+    double transport_load_time = ElapsedSeconds(start);
+
+    cout << "  Ciphertext::save (uncompressed):\t" << save_bytes / (1024 * 1024) << " MB/iteration\tserialize: " << save_time << "s\tdeserialize: " << load_time
+         << "s" << endl;
+    cout << "  transport:\t\t\t\t" << transport_bytes / (1024 * 1024) << " MB/iteration\tserialize: " << transport_save_time
+         << "s\tdeserialize: " << transport_load_time << "s" << endl
+         << endl;
+}
+
+// One ColumnGradient over synthetic data in which each (block, feature) column is 0 with probability 1 - density,
+// with the dense and the sparse column layouts: ciphertexts, multiplies, rotations, encryption and gradient time.
+void BenchmarkSparsity(SEALContext &context, CKKSEncoder &encoder, SecretKey &secret_key, RelinKeys &relin_keys, GaloisKeys &galois_keys,
+                       double scale, size_t row_count, size_t feature_count, const vector<double> &densities)
+{
+    size_t slot_count = encoder.slot_count();
+    size_t block_count = (row_count + slot_count - 1) / slot_count;
+    size_t log_slot_count = 0;
+    while ((size_t(1) << log_slot_count) < slot_count)
+    {
+        ++log_slot_count;
+    }
+    cout << "[Sparsity] " << row_count << " rows x " << feature_count << " features, " << block_count << " blocks" << endl;
+
+    for (double density : densities)
+    {
+        // The bias column is never 0
+        mt19937 generator(0);
+        bernoulli_distribution nonzero(density);
+        vector<vector<double>> dataset = GenerateDataset(row_count, feature_count, 0.5, 0);
+        vector<vector<double>> features(row_count, vector<double>(feature_count + 1, 1));
+        vector<double> labels(row_count);
+        for (size_t b = 0; b < block_count; ++b)
+        {
+            for (size_t j = 0; j < feature_count; ++j)
+            {
+                bool keep = nonzero(generator);
+                for (size_t i = b * slot_count; i < min(row_count, (b + 1) * slot_count); ++i)
+                {
+                    features[i][j + 1] = keep ? dataset[i][j] : 0;
+                }
+            }
+        }
+        for (size_t i = 0; i < row_count; ++i)
+        {
+            labels[i] = dataset[i][feature_count];
+        }
+        vector<double> weights(feature_count + 1, 0.1);
+
+        cout << "  density " << density << ":" << endl;
+        double dense_time = 0;
+        for (bool sparse : {false, true})
+        {
+            auto start = chrono::high_resolution_clock::now();
+            ColumnDataset columns = EncryptColumns(context, encoder, secret_key, scale, features, labels, sparse);
+            double encrypt_time = ElapsedSeconds(start);
+
+            start = chrono::high_resolution_clock::now();
+            ColumnGradient(context, relin_keys, galois_keys, scale, columns, weights);
+            double gradient_time = ElapsedSeconds(start);
+            if (!sparse)
+            {
+                dense_time = gradient_time;
+            }
+
+            // A stored column costs one multiply_plain and one multiply; a feature with a stored column costs its rotations
+            size_t multiplies = ColumnCiphertextCount(columns) - columns.labels.size();
+            size_t rotations = count(columns.zero_features.begin(), columns.zero_features.end(), false) * log_slot_count;
+            cout << "    " << (sparse ? "sparse" : "dense ") << "\t" << ColumnCiphertextCount(columns) << " ciphertexts\t"
+                 << 2 * multiplies << " multiplies\t" << rotations << " rotations\tencrypt: " << encrypt_time << "s\t"
+                 << "gradient: " << gradient_time << "s\tspeedup: " << dense_time / gradient_time << endl;
+        }
+    }
+    cout << endl;
+}
+
+// Generate the keys of the key store benchmark in a child process, so that this process never holds them
+void CreateBenchmarkKeyStore(SEALContext &context, string filename)
+{
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        try
+        {
+            KeyGenerator keygen(context);
+            PublicKey public_key;
+            keygen.create_public_key(public_key);
+            RelinKeys relin_keys;
+            keygen.create_relin_keys(relin_keys);
+            GaloisKeys galois_keys;
+            keygen.create_galois_keys(galois_keys);
+            WriteKeyStore(filename, context, keygen.secret_key(), public_key, relin_keys, galois_keys);
+        }
+        catch (exception &e)
+        {
+            cerr << "Key store: " << e.what() << endl;
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        throw runtime_error("cannot create " + filename);
+    }
+}
+
+// Fork worker_count workers that encrypt and rotate with the public and Galois keys, and print their average
+// startup time (fork to first rotation), RSS and PSS, measured once all of them are up.
+// With shared, the keys are loaded from the store here once and the workers inherit them;
+// otherwise every worker loads its own copy from the store.
+void RunKeyWorkers(SEALContext &context, string store_filename, size_t worker_count, bool shared)
+{
+    double scale = pow(2.0, 40);
+    KeyStore store(store_filename, context);
+    PublicKey public_key;
+    GaloisKeys galois_keys;
+    auto start = chrono::high_resolution_clock::now();
+    if (shared)
+    {
+        LoadFromKeyStore(context, store, public_key);
+        LoadFromKeyStore(context, store, galois_keys);
+    }
+    double load_time = ElapsedSeconds(start);
+
+    int ready_pipe[2], go_pipe[2], report_pipe[2];
+    if (pipe(ready_pipe) != 0 || pipe(go_pipe) != 0 || pipe(report_pipe) != 0)
+    {
+        throw runtime_error("cannot create pipes");
+    }
+    vector<pid_t> worker_pids;
+    for (size_t w = 0; w < worker_count; ++w)
+    {
+        cout.flush();
+        auto fork_time = chrono::high_resolution_clock::now();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(go_pipe[1]);
+            try
+            {
+                if (!shared)
+                {
+                    LoadFromKeyStore(context, store, public_key);
+                    LoadFromKeyStore(context, store, galois_keys);
+                }
+                CKKSEncoder encoder(context);
+                Evaluator evaluator(context);
+                Plaintext plain_zero;
+                Encode(encoder, 0.0, scale, plain_zero);
+                Ciphertext encrypted_zero = Encrypt(context, public_key, scale, plain_zero);
+                evaluator.rotate_vector_inplace(encrypted_zero, 1, galois_keys);
+            }
+            catch (exception &e)
+            {
+                cerr << "Worker " << w << ": " << e.what() << endl;
+                _exit(1);
+            }
+            double startup_time = ElapsedSeconds(fork_time);
+
+            // Measure once every worker is up, so that PSS divides the shared pages among all of them
+            char byte = 1;
+            write(ready_pipe[1], &byte, 1);
+            read(go_pipe[0], &byte, 1);
+            stringstream report;
+            report << startup_time << " " << CurrentRSS() << " " << ProportionalSetSize() << "\n";
+            write(report_pipe[1], report.str().data(), report.str().size());
+            _exit(0);
+        }
+        worker_pids.push_back(pid);
+    }
+    close(ready_pipe[1]);
+    close(go_pipe[0]);
+    close(report_pipe[1]);
+
+    char byte;
+    for (size_t w = 0; w < worker_count && read(ready_pipe[0], &byte, 1) == 1; ++w)
+    {
+    }
+    close(go_pipe[1]);
+
+    string reports;
+    char buffer[4096];
+    ssize_t received;
+    while ((received = read(report_pipe[0], buffer, sizeof(buffer))) > 0)
+    {
+        reports.append(buffer, received);
+    }
+    for (pid_t pid : worker_pids)
+    {
+        waitpid(pid, nullptr, 0);
+    }
+    close(ready_pipe[0]);
+    close(report_pipe[0]);
+
+    stringstream report_stream(reports);
+    double startup_time, total_startup_time = 0;
+    size_t rss, pss, total_rss = 0, total_pss = 0, report_count = 0;
+    while (report_stream >> startup_time >> rss >> pss)
+    {
+        total_startup_time += startup_time;
+        total_rss += rss;
+        total_pss += pss;
+        ++report_count;
+    }
+    if (report_count < worker_count)
+    {
+        throw runtime_error("a key worker failed");
+    }
+
+    cout << "  " << (shared ? "shared " : "private") << "\t" << worker_count << " workers\tstartup: " << total_startup_time / report_count * 1000
+         << " ms\tRSS: " << total_rss / report_count / (1024 * 1024) << " MB/worker\tPSS: " << total_pss / report_count / (1024 * 1024)
+         << " MB/worker\ttotal PSS: " << total_pss / (1024 * 1024) << " MB";
+    if (shared)
+    {
+        cout << "\t(keys loaded once in " << load_time * 1000 << " ms)";
+    }
+    cout << endl;
+}
+
+// Footprint and startup of worker processes that each load their own keys from the key store,
+// against workers forked after the keys were loaded once
+void BenchmarkKeyStore(SEALContext &context, const vector<size_t> &worker_counts)
+{
+    string store_filename = "weights/benchmark_key_store.bin";
+    auto start = chrono::high_resolution_clock::now();
+    CreateBenchmarkKeyStore(context, store_filename);
+    double keygen_time = ElapsedSeconds(start);
+    cout << "[Key store] " << filesystem::file_size(store_filename) / (1024 * 1024) << " MB of keys, generated in " << keygen_time << "s" << endl;
+
+    // The private runs go first: a shared run leaves the keys in this process' memory pool
+    for (bool shared : {false, true})
+    {
+        for (size_t worker_count : worker_counts)
+        {
+            RunKeyWorkers(context, store_filename, worker_count, shared);
+        }
+    }
+    filesystem::remove(store_filename);
+    cout << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    string benchmark = argc > 1 ? argv[1] : "all";
+
+    // The rows of the raw csv are scaled to unit L2 norm while it is read, as diabetes_normalized.csv was; no normalized copy is written
+    vector<vector<double>> train_features;
+    vector<double> labels;
+    ReadScaledDataset("dataset/diabetes.csv", "l2", thread::hardware_concurrency(), train_features, labels);
+
+    SEALContext context = SetupCKKS();
+    print_parameters(context);
+    PrintKernelReport(context);
+
+    // keystore [workers ...]: before any key is generated here, so that the workers are forked from a process without keys
+    if (benchmark == "keystore")
+    {
+        vector<size_t> worker_counts = {1, 4, 16};
+        if (argc > 2)
+        {
+            worker_counts.clear();
+            for (int i = 2; i < argc; ++i)
+            {
+                worker_counts.push_back(stoul(argv[i]));
+            }
+        }
+        BenchmarkKeyStore(context, worker_counts);
+        return 0;
+    }
+
+    double scale = pow(2.0, 40);
+    CKKSEncoder encoder(context);
+
+    KeyGenerator keygen(context);
+    SecretKey secret_key = keygen.secret_key();
+    PublicKey public_key;
+    keygen.create_public_key(public_key);
+    RelinKeys relin_keys;
+    keygen.create_relin_keys(relin_keys);
+    GaloisKeys galois_keys;
+    keygen.create_galois_keys(galois_keys);
+
+    if (benchmark == "all" || benchmark == "encrypt")
+    {
+        BenchmarkEncryption(context, encoder, public_key, secret_key, scale, train_features);
+    }
+
+    // train [iterations]
+    if (benchmark == "all" || benchmark == "train")
+    {
+        int iterations = benchmark == "train" && argc > 2 ? stoi(argv[2]) : 3;
+        BenchmarkTrain(context, encoder, public_key, relin_keys, galois_keys, scale, train_features, labels, iterations);
+    }
+
+    if (benchmark == "all" || benchmark == "layout")
+    {
+        BenchmarkLayouts(context, encoder, public_key, secret_key, relin_keys, galois_keys, scale, train_features, labels);
+    }
+
+    // rotations [width ...]
+    if (benchmark == "all" || benchmark == "rotations")
+    {
+        vector<size_t> widths = {9, 16, 64};
+        if (benchmark == "rotations" && argc > 2)
+        {
+            widths.clear();
+            for (int i = 2; i < argc; ++i)
+            {
+                widths.push_back(stoul(argv[i]));
+            }
+        }
+        BenchmarkRotations(context, encoder, public_key, keygen, galois_keys, scale, widths);
+    }
+
+    if (benchmark == "all" || benchmark == "levels")
+    {
+        BenchmarkSampleLevel(context, encoder, secret_key, scale, train_features, labels);
+    }
+
+    if (benchmark == "all" || benchmark == "transport")
+    {
+        BenchmarkTransport(context, encoder, public_key, scale, train_features);
+    }
+
+    // inference [records]
+    if (benchmark == "all" || benchmark == "inference")
+    {
+        size_t record_count = benchmark == "inference" && argc > 2 ? stoul(argv[2]) : 64;
+        BenchmarkInference(context, encoder, public_key, keygen, relin_keys, scale, train_features, record_count);
+    }
+
+    // sparsity [rows] [features] [density ...]
+    if (benchmark == "sparsity")
+    {
+        size_t row_count = argc > 2 ? stoul(argv[2]) : 4 * encoder.slot_count();
+        size_t feature_count = argc > 3 ? stoul(argv[3]) : 16;
+        vector<double> densities = {1, 0.5, 0.25, 0.1};
+        if (argc > 4)
+        {
+            densities.clear();
+            for (int i = 4; i < argc; ++i)
+            {
+                densities.push_back(stod(argv[i]));
+            }
+        }
+        BenchmarkSparsity(context, encoder, secret_key, relin_keys, galois_keys, scale, row_count, feature_count, densities);
+    }
+
+    // scaling [features] [rows ...]
+    if (benchmark == "scaling")
+    {
+        size_t feature_count = argc > 2 ? stoul(argv[2]) : 8;
+        vector<size_t> row_counts = {256, 1024, 4096};
+        if (argc > 3)
+        {
+            row_counts.clear();
+            for (int i = 3; i < argc; ++i)
+            {
+                row_counts.push_back(stoul(argv[i]));
+            }
+        }
+        BenchmarkScaling(context, encoder, public_key, secret_key, relin_keys, scale, feature_count, row_counts, "scaling.csv");
+    }
+
+    return 0;
+}
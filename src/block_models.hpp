@@ -0,0 +1,98 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <sstream>
+#include <functional>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "packing.hpp"
+#include "plain_algorithms.hpp"
+using namespace std;
+using namespace seal;
+
+// Training loop shared by the learning rate sweep and the one-vs-rest models: several models trained in the same
+// ciphertexts, model k in block k (see packing.hpp). The samples are replicated into every block; the labels,
+// the learning rates and the weights may differ per block.
+
+// Train weights.size() models for max_iter iterations.
+// Block k of the label of sample i holds block_labels[i][k], and model k is trained with learning_rates[k].
+// weights holds the initial weights of every model and receives the trained ones.
+// After every iteration, report gets the weights of every model.
+void TrainBlockModels(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key,
+                      RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale,
+                      const vector<vector<double>> &features, const vector<vector<double>> &block_labels,
+                      const vector<double> &learning_rates, vector<vector<double>> &weights, int max_iter,
+                      const function<void(const vector<vector<double>> &)> &report)
+{
+    size_t slot_count = encoder.slot_count();
+    size_t width = features[0].size();
+    size_t block_size = BlockSize(width);
+    size_t model_count = weights.size();
+
+    // Encrypt the samples replicated into every block, and the labels of every block
+    vector<Ciphertext> encrypted_features;
+    vector<Ciphertext> encrypted_labels;
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        vector<double> replicated = ReplicateIntoBlocks(features[i], block_size, model_count);
+        Plaintext plain_feature;
+        Encode(encoder, replicated, SampleParmsId(context), scale, plain_feature);
+        stringstream upload;
+        EncryptSymmetricToStream(context, secret_key, plain_feature, upload);
+        encrypted_features.push_back(LoadCiphertext(context, upload));
+
+        vector<double> packed_labels = BroadcastIntoBlocks(block_labels[i], block_size);
+        Plaintext plain_label;
+        Encode(encoder, packed_labels, SampleParmsId(context), scale, plain_label);
+        upload.str("");
+        upload.clear();
+        EncryptSymmetricToStream(context, secret_key, plain_label, upload);
+        encrypted_labels.push_back(LoadCiphertext(context, upload));
+    }
+
+    // Learning rate k fills block k
+    vector<double> packed_learning_rates = BroadcastIntoBlocks(learning_rates, block_size);
+    Plaintext plain_learning_rates;
+    Encode(encoder, packed_learning_rates, SampleParmsId(context), scale, plain_learning_rates);
+    Ciphertext encrypted_learning_rates = Encrypt(context, public_key, scale, plain_learning_rates);
+
+    GradientWorkspace workspace(context);
+    for (int iteration = 1; iteration <= max_iter; ++iteration)
+    {
+        cout << "Iteration #" << iteration << "...\t\t";
+
+        // Block k of a product holds sample . weights[k]
+        vector<Ciphertext> encrypted_products;
+        for (size_t i = 0; i < features.size(); ++i)
+        {
+            vector<double> products(model_count);
+            for (size_t k = 0; k < model_count; ++k)
+            {
+                products[k] = PlainVectorMultiplication(features[i], weights[k]);
+            }
+            vector<double> packed_products = BroadcastIntoBlocks(products, block_size);
+            Plaintext plain_product;
+            Encode(encoder, packed_products, scale, plain_product);
+            encrypted_products.push_back(Encrypt(context, public_key, scale, plain_product));
+        }
+
+        vector<double> packed_weights = PackBlocks(weights, block_size);
+        Plaintext plain_weights;
+        Encode(encoder, packed_weights, context.last_parms_id(), scale, plain_weights);
+        Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+
+        unsigned long iteration_start = clock();
+        Ciphertext encrypted_trained_weights = Train(context, relin_keys, galois_keys, scale, encrypted_products, encrypted_features, encrypted_labels,
+                                                     encrypted_weights, encrypted_learning_rates, slot_count, workspace);
+        unsigned long iteration_end = clock();
+
+        Plaintext plain_trained_weights = Decrypt(context, secret_key, encrypted_trained_weights);
+        vector<double> trained_slots;
+        Decode(encoder, plain_trained_weights, trained_slots);
+        weights = UnpackBlocks(trained_slots, block_size, model_count, width);
+
+        cout << "Training time: " << (iteration_end - iteration_start) / CLOCKS_PER_SEC << "s\t\t";
+        report(weights);
+    }
+}
@@ -0,0 +1,200 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "packing.hpp"
+#include "data_preprocessing.hpp"
+using namespace std;
+using namespace seal;
+
+// Binary training checkpoint, written after every iteration:
+//     magic, version, parms_id of the encryption parameters, fingerprint of the secret key,
+//     RNG seed, last completed iteration, learning rate, best accuracy, encrypted weights,
+//     records of the sample log trained on (version 2)
+struct TrainingCheckpoint
+{
+    parms_id_type parms_id;
+    uint64_t key_fingerprint;
+    unsigned int seed;
+    int iteration;
+    double learning_rate;
+    double best_accuracy;
+    Ciphertext encrypted_weights;
+    // Online training only (see online.hpp); 0 for batch training
+    uint64_t log_records = 0;
+};
+
+const char CHECKPOINT_MAGIC[8] = {'H', 'E', 'L', 'R', 'C', 'K', 'P', 'T'};
+const uint32_t CHECKPOINT_VERSION = 2;
+
+template <typename T>
+void WriteValue(ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+void ReadValue(istream &in, T &value)
+{
+    in.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+// Identify a secret key without storing it: the hash of its serialized form
+uint64_t KeyFingerprint(const SecretKey &secret_key)
+{
+    stringstream key_stream;
+    secret_key.save(key_stream, compr_mode_type::none);
+    return hash<string>{}(key_stream.str());
+}
+
+// Identify the plaintext dataset, so that a cached encryption of an older version is not reused
+uint64_t DatasetFingerprint(const vector<vector<double>> &features, const vector<double> &labels)
+{
+    string bytes;
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        bytes.append(reinterpret_cast<const char *>(features[i].data()), features[i].size() * sizeof(double));
+    }
+    bytes.append(reinterpret_cast<const char *>(labels.data()), labels.size() * sizeof(double));
+    return hash<string>{}(bytes);
+}
+
+void WriteCheckpoint(string filename, const TrainingCheckpoint &checkpoint)
+{
+    WriteFileAtomically(filename, [&](ostream &out)
+                        {
+                            out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+                            WriteValue(out, CHECKPOINT_VERSION);
+                            WriteValue(out, checkpoint.parms_id);
+                            WriteValue(out, checkpoint.key_fingerprint);
+                            WriteValue(out, checkpoint.seed);
+                            WriteValue(out, checkpoint.iteration);
+                            WriteValue(out, checkpoint.learning_rate);
+                            WriteValue(out, checkpoint.best_accuracy);
+                            checkpoint.encrypted_weights.save(out);
+                            WriteValue(out, checkpoint.log_records);
+                        });
+}
+
+// Return false if there is no checkpoint to resume from.
+// Throw if the checkpoint is unreadable or was written with other encryption parameters.
+bool ReadCheckpoint(string filename, SEALContext &context, TrainingCheckpoint &checkpoint)
+{
+    if (!filesystem::exists(filename))
+    {
+        return false;
+    }
+
+    fstream fin;
+    fin.open(filename, ios::in | ios::binary);
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    uint32_t version;
+    fin.read(magic, sizeof(magic));
+    ReadValue(fin, version);
+    if (!fin.good() || !equal(magic, magic + sizeof(magic), CHECKPOINT_MAGIC) || version < 1 || version > CHECKPOINT_VERSION)
+    {
+        throw runtime_error(filename + " is not a checkpoint of a supported version");
+    }
+
+    ReadValue(fin, checkpoint.parms_id);
+    ReadValue(fin, checkpoint.key_fingerprint);
+    ReadValue(fin, checkpoint.seed);
+    ReadValue(fin, checkpoint.iteration);
+    ReadValue(fin, checkpoint.learning_rate);
+    ReadValue(fin, checkpoint.best_accuracy);
+    if (checkpoint.parms_id != context.key_parms_id())
+    {
+        throw runtime_error(filename + " was written with different encryption parameters");
+    }
+    checkpoint.encrypted_weights.load(context, fin);
+    // Version 1 checkpoints predate online training
+    checkpoint.log_records = 0;
+    if (version >= 2)
+    {
+        ReadValue(fin, checkpoint.log_records);
+    }
+    fin.close();
+    return true;
+}
+
+// The secret key is only kept on disk when the caller asks for it with a filename, so that an interrupted run can be resumed.
+// It must not sit next to the checkpoint it decrypts: a filename inside the weights directory is rejected,
+// and the file is readable by its owner only. With an empty filename a new key is generated and never written.
+SecretKey LoadOrCreateSecretKey(string filename, SEALContext &context)
+{
+    SecretKey secret_key;
+    if (filename.empty())
+    {
+        KeyGenerator keygen(context);
+        return keygen.secret_key();
+    }
+    if (filesystem::weakly_canonical(filesystem::path(filename).parent_path()) == filesystem::weakly_canonical("weights"))
+    {
+        throw invalid_argument("keep the secret key " + filename + " outside the weights directory");
+    }
+    if (filesystem::exists(filename))
+    {
+        fstream fin;
+        fin.open(filename, ios::in | ios::binary);
+        secret_key.load(context, fin);
+        fin.close();
+        return secret_key;
+    }
+
+    KeyGenerator keygen(context);
+    secret_key = keygen.secret_key();
+    WriteFileAtomically(
+        filename, [&](ostream &out)
+        { secret_key.save(out); },
+        filesystem::perms::owner_read | filesystem::perms::owner_write);
+    return secret_key;
+}
+
+// Load the label-packed samples (see PackSampleWithLabel) from the cache file, encrypting and caching them first if needed.
+// They are encrypted at the level where Train first uses them (SampleParmsId).
+// The cache is tied to the secret key and to the plaintext dataset through its file name.
+void LoadOrEncryptDataset(string cache_prefix, SEALContext &context, CKKSEncoder &encoder, SecretKey &secret_key, double scale,
+                          const vector<vector<double>> &features, const vector<double> &labels, vector<Ciphertext> &packed_samples)
+{
+    stringstream cache_filename;
+    cache_filename << cache_prefix << "_" << hex << KeyFingerprint(secret_key) << "_" << DatasetFingerprint(features, labels)
+                   << "_L" << context.get_context_data(SampleParmsId(context))->chain_index() << ".bin";
+
+    if (!filesystem::exists(cache_filename.str()))
+    {
+        streamoff bytes = 0;
+        WriteFileAtomically(cache_filename.str(), [&](ostream &out)
+                            {
+                                for (size_t i = 0; i < features.size(); ++i)
+                                {
+                                    vector<double> packed_sample = PackSampleWithLabel(features[i], labels[i]);
+                                    Plaintext plain_sample;
+                                    Encode(encoder, packed_sample, SampleParmsId(context), scale, plain_sample);
+                                    bytes += EncryptSymmetricToStream(context, secret_key, plain_sample, out);
+                                } });
+        cout << "Cached encrypted dataset: " << bytes / (1024 * 1024) << " MB" << endl;
+    }
+    else
+    {
+        cout << "Loading cached encrypted dataset " << cache_filename.str() << endl;
+    }
+
+    fstream fin;
+    fin.open(cache_filename.str(), ios::in | ios::binary);
+    packed_samples.clear();
+    packed_samples.reserve(features.size());
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        packed_samples.push_back(LoadCiphertext(context, fin));
+    }
+    fin.close();
+}
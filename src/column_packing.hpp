@@ -0,0 +1,261 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "plain_algorithms.hpp"
+using namespace std;
+using namespace seal;
+
+// Column-major layout: one sample per slot.
+// columns[b][j] holds feature j of samples [b * slot_count, (b + 1) * slot_count),
+// labels[b] holds their labels, so the 768 x 9 diabetes set fits in 9 + 1 ciphertexts.
+// The weights stay in plaintext: Xw is a sum of scalar multiplies, and the gradient of
+// feature j is a rotate-and-sum of (y - sigmoid(Xw)) * X_j.
+// In the sparse layout a block of a column that is 0 for all of its samples is not encrypted: it adds nothing
+// to Xw or to the gradient, so its multiplies are skipped, and so are the rotations of a feature that is 0 everywhere.
+struct ColumnDataset
+{
+    size_t sample_count;
+    size_t feature_count;
+    // columns[b][k] holds feature column_features[b][k]; every feature in the dense layout
+    vector<vector<Ciphertext>> columns;
+    vector<vector<size_t>> column_features;
+    vector<Ciphertext> labels;
+    // Features left out of every block, whose gradient is 0
+    vector<bool> zero_features;
+};
+
+// Data owner side: transpose the dataset into slot-count blocks and encrypt every column symmetrically.
+// With sparse, the all-zero blocks of every column are left out.
+ColumnDataset EncryptColumns(SEALContext &context, CKKSEncoder &encoder, SecretKey &secret_key, double scale,
+                             const vector<vector<double>> &features, const vector<double> &labels, bool sparse = false)
+{
+    size_t slot_count = encoder.slot_count();
+
+    ColumnDataset dataset;
+    dataset.sample_count = features.size();
+    dataset.feature_count = features[0].size();
+    size_t block_count = (features.size() + slot_count - 1) / slot_count;
+    dataset.columns.resize(block_count);
+    dataset.column_features.resize(block_count);
+    dataset.zero_features.assign(dataset.feature_count, true);
+    for (size_t b = 0; b < block_count; ++b)
+    {
+        size_t first = b * slot_count;
+        size_t last = min(features.size(), first + slot_count);
+
+        for (size_t j = 0; j < dataset.feature_count; ++j)
+        {
+            vector<double> column(last - first);
+            for (size_t i = first; i < last; ++i)
+            {
+                column[i - first] = features[i][j];
+            }
+            if (sparse && all_of(column.begin(), column.end(), [](double x)
+                                 { return x == 0; }))
+            {
+                continue;
+            }
+            Plaintext plain_column;
+            Encode(encoder, column, scale, plain_column);
+            stringstream upload;
+            EncryptSymmetricToStream(context, secret_key, plain_column, upload);
+            dataset.columns[b].push_back(LoadCiphertext(context, upload));
+            dataset.column_features[b].push_back(j);
+            dataset.zero_features[j] = false;
+        }
+
+        vector<double> label_column(labels.begin() + first, labels.begin() + last);
+        Plaintext plain_labels;
+        Encode(encoder, label_column, scale, plain_labels);
+        stringstream upload;
+        EncryptSymmetricToStream(context, secret_key, plain_labels, upload);
+        dataset.labels.push_back(LoadCiphertext(context, upload));
+    }
+    return dataset;
+}
+
+// Number of column ciphertexts of the dataset, labels included
+size_t ColumnCiphertextCount(const ColumnDataset &dataset)
+{
+    size_t count = dataset.labels.size();
+    for (size_t b = 0; b < dataset.columns.size(); ++b)
+    {
+        count += dataset.columns[b].size();
+    }
+    return count;
+}
+
+// Rotate-and-sum: afterwards every slot holds the sum of all slots
+void SumSlots(Evaluator &evaluator, GaloisKeys &galois_keys, Ciphertext &encrypted, size_t slot_count)
+{
+    Ciphertext rotated;
+    for (size_t step = 1; step < slot_count; step <<= 1)
+    {
+        evaluator.rotate_vector(encrypted, int(step), galois_keys, rotated);
+        evaluator.add_inplace(encrypted, rotated);
+    }
+}
+
+// Compute sum_i (y_i - sigmoid(x_i . w)) * x_ij for every feature j with plaintext weights.
+// Ciphertext j of the output holds the gradient of feature j in every slot; it is left empty for the zero features.
+// Levels:
+// columns, labels  -> Level 5
+// Xw               -> Level 4
+// sigmoid          -> Level 1
+// gradient         -> Level 0
+vector<Ciphertext> ColumnGradient(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale,
+                                  const ColumnDataset &dataset, const vector<double> &weights)
+{
+    Evaluator evaluator(context);
+    CKKSEncoder encoder(context);
+    size_t slot_count = encoder.slot_count();
+
+    vector<Ciphertext> gradients(dataset.feature_count);
+    for (size_t b = 0; b < dataset.columns.size(); ++b)
+    {
+        const vector<Ciphertext> &columns = dataset.columns[b];
+        const vector<size_t> &column_features = dataset.column_features[b];
+        if (columns.empty())
+        {
+            // Every feature of this block is 0: it adds nothing to any gradient
+            continue;
+        }
+
+        // ----------------------------------------------------------------- //
+        // Xw = sum_j w_j * X_j
+        // A weight of exactly 0 would make a transparent ciphertext, which SEAL rejects, so its term is left out
+        Ciphertext encrypted_products;
+        bool has_products = false;
+        for (size_t k = 0; k < columns.size(); ++k)
+        {
+            double weight = weights[column_features[k]];
+            if (weight == 0)
+            {
+                continue;
+            }
+            Plaintext plain_weight;
+            Encode(encoder, weight, scale, plain_weight);
+            evaluator.mod_switch_to_inplace(plain_weight, columns[k].parms_id());
+
+            Ciphertext weighted_column;
+            evaluator.multiply_plain(columns[k], plain_weight, weighted_column);
+            evaluator.rescale_to_next_inplace(weighted_column);
+            weighted_column.scale() = scale;
+            if (!has_products)
+            {
+                encrypted_products = weighted_column;
+                has_products = true;
+            }
+            else
+            {
+                evaluator.add_inplace(encrypted_products, weighted_column);
+            }
+        }
+        // encrypted_products -> Level 4
+
+        // ----------------------------------------------------------------- //
+        // residual = y - sigmoid(Xw)
+        Ciphertext y = dataset.labels[b];
+        y.scale() = scale;
+        Ciphertext residual;
+        if (has_products)
+        {
+            residual = Sigmoid(context, relin_keys, scale, encrypted_products);
+            residual.scale() = scale;
+            // residual -> Level 1
+
+            evaluator.mod_switch_to_inplace(y, residual.parms_id());
+            evaluator.negate_inplace(residual);
+            evaluator.add_inplace(residual, y);
+        }
+        else
+        {
+            // Every weight of this block is 0, so sigmoid(Xw) = 0.5 and residual = y - 0.5
+            evaluator.mod_switch_to(y, GradientParmsId(context), residual);
+            Plaintext plain_half;
+            Encode(encoder, -0.5, residual.parms_id(), scale, plain_half);
+            evaluator.add_plain_inplace(residual, plain_half);
+            // residual -> Level 1
+        }
+        // Slots past the last sample are not 0 here, but every X_j is 0 there
+
+        // ----------------------------------------------------------------- //
+        // gradient_j += residual * X_j
+        for (size_t k = 0; k < columns.size(); ++k)
+        {
+            size_t j = column_features[k];
+            Ciphertext x = columns[k];
+            x.scale() = scale;
+            evaluator.mod_switch_to_inplace(x, residual.parms_id());
+
+            Ciphertext partial_derivative;
+            evaluator.multiply(residual, x, partial_derivative);
+            evaluator.relinearize_inplace(partial_derivative, relin_keys);
+            evaluator.rescale_to_next_inplace(partial_derivative);
+            partial_derivative.scale() = scale;
+            // partial_derivative -> Level 0
+
+            if (gradients[j].size() == 0)
+            {
+                gradients[j] = partial_derivative;
+            }
+            else
+            {
+                evaluator.add_inplace(gradients[j], partial_derivative);
+            }
+        }
+    }
+
+    // ----------------------------------------------------------------- //
+    // Sum over the samples
+    for (size_t j = 0; j < dataset.feature_count; ++j)
+    {
+        if (!dataset.zero_features[j])
+        {
+            SumSlots(evaluator, galois_keys, gradients[j], slot_count);
+        }
+    }
+    return gradients;
+}
+
+// Training loop of main() for the column layout.
+// The key holder decrypts the gradients and applies weights += learning_rate / m * gradient in plaintext.
+vector<double> TrainColumns(SEALContext &context, CKKSEncoder &encoder, SecretKey &secret_key, RelinKeys &relin_keys, GaloisKeys &galois_keys,
+                            double scale, const vector<vector<double>> &features, const vector<double> &labels, vector<double> weights,
+                            double learning_rate, int max_iter, bool sparse = false)
+{
+    ColumnDataset dataset = EncryptColumns(context, encoder, secret_key, scale, features, labels, sparse);
+    size_t dense_count = dataset.columns.size() * (dataset.feature_count + 1);
+    cout << "Encrypted " << ColumnCiphertextCount(dataset) << " column ciphertexts (" << dense_count - ColumnCiphertextCount(dataset)
+         << " all-zero blocks left out)" << endl;
+
+    for (int iteration = 1; iteration <= max_iter; ++iteration)
+    {
+        cout << "Iteration #" << iteration << "...\t\t";
+
+        unsigned long iteration_start = clock();
+        vector<Ciphertext> encrypted_gradients = ColumnGradient(context, relin_keys, galois_keys, scale, dataset, weights);
+        unsigned long iteration_end = clock();
+
+        for (size_t j = 0; j < weights.size(); ++j)
+        {
+            if (dataset.zero_features[j])
+            {
+                continue;
+            }
+            Plaintext plain_gradient = Decrypt(context, secret_key, encrypted_gradients[j]);
+            vector<double> gradient;
+            Decode(encoder, plain_gradient, gradient);
+            weights[j] += learning_rate / dataset.sample_count * gradient[0];
+        }
+
+        cout << "Training time: " << (iteration_end - iteration_start) / CLOCKS_PER_SEC << "s\t\t";
+        cout << "Train accuracy: " << ComputeAccuracy(features, labels, weights) << endl;
+    }
+    return weights;
+}
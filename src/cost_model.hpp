@@ -0,0 +1,445 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <cmath>
+#include <filesystem>
+#include <stdexcept>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+using namespace std;
+using namespace seal;
+
+// Dry-run cost model of a training configuration.
+// The Train circuit is walked without encrypting anything: every SEAL operation is counted at the level
+// it runs on, and the counts are multiplied by latencies measured once on this machine.
+// Levels are chain indices, as in the comments of homomorphic.hpp: fresh ciphertexts are at the top level (5).
+
+// counts[op][level] or latencies[op][level]
+typedef map<string, vector<double>> OpTable;
+
+const vector<string> COST_MODEL_OPS = {"encode", "encrypt", "decrypt", "add", "negate", "multiply", "multiply_plain",
+                                       "relinearize", "rescale", "mod_switch", "rotate"};
+
+struct TrainingConfig
+{
+    string layout; // rows, packed or columns
+    size_t sample_count;
+    size_t feature_count;
+    size_t thread_count;
+};
+
+struct CostEstimate
+{
+    OpTable counts;
+    double seconds_per_iteration;
+    double setup_seconds;
+    size_t peak_bytes;
+    size_t dataset_bytes;
+    size_t upload_bytes_per_iteration;
+};
+
+// Only the rows layout spreads its samples over threads (GradientSumParallel);
+// the packed layout of main's train mode and the columns layout run on one thread.
+bool LayoutRunsInParallel(const string &layout)
+{
+    return layout == "rows";
+}
+
+size_t TopLevel(SEALContext &context)
+{
+    return context.first_context_data()->chain_index();
+}
+
+// Bytes of a size-2 ciphertext at level, uncompressed
+size_t CiphertextBytes(SEALContext &context, size_t level)
+{
+    size_t poly_modulus_degree = context.first_context_data()->parms().poly_modulus_degree();
+    return 2 * poly_modulus_degree * (level + 1) * sizeof(uint64_t);
+}
+
+void Count(OpTable &counts, string op, size_t level, double n = 1)
+{
+    counts[op][level] += n;
+}
+
+// mod_switch_to from level from to level to is one mod_switch per level in between
+void CountModSwitch(OpTable &counts, size_t from, size_t to, double n)
+{
+    for (size_t level = from; level > to; --level)
+    {
+        Count(counts, "mod_switch", level, n);
+    }
+}
+
+// n calls of Sigmoid() on inputs at level; return the output level
+size_t CountSigmoid(OpTable &counts, size_t level, double n)
+{
+    // x_sq, x_quad
+    Count(counts, "multiply", level, n);
+    Count(counts, "relinearize", level, n);
+    Count(counts, "rescale", level, n);
+    Count(counts, "multiply", level - 1, n);
+    Count(counts, "relinearize", level - 1, n);
+    Count(counts, "rescale", level - 1, n);
+
+    // 0.002x^5
+    Count(counts, "multiply_plain", level, n);
+    Count(counts, "rescale", level, n);
+    CountModSwitch(counts, level - 1, level - 2, n);
+    Count(counts, "multiply", level - 2, n);
+    Count(counts, "relinearize", level - 2, n);
+    Count(counts, "rescale", level - 2, n);
+
+    // 0.021x^3
+    Count(counts, "multiply_plain", level, n);
+    Count(counts, "rescale", level, n);
+    Count(counts, "multiply", level - 1, n);
+    Count(counts, "relinearize", level - 1, n);
+    Count(counts, "rescale", level - 1, n);
+    CountModSwitch(counts, level - 2, level - 3, n);
+
+    // 0.25x
+    Count(counts, "multiply_plain", level, n);
+    Count(counts, "rescale", level, n);
+    CountModSwitch(counts, level - 1, level - 3, n);
+
+    // 0.5 + 0.25x - 0.021x^3 + 0.002x^5
+    Count(counts, "add", level - 3, 3 * n);
+    return level - 3;
+}
+
+// UpdateWeight() with the learning rate at learning_rate_level, the weights at weight_level and the derivatives sum at level
+void CountUpdateWeight(OpTable &counts, size_t learning_rate_level, size_t weight_level, size_t level)
+{
+    Count(counts, "encode", learning_rate_level);
+    Count(counts, "multiply_plain", learning_rate_level);
+    Count(counts, "relinearize", learning_rate_level);
+    Count(counts, "rescale", learning_rate_level);
+    CountModSwitch(counts, learning_rate_level - 1, level, 1);
+    Count(counts, "multiply", level);
+    Count(counts, "relinearize", level);
+    Count(counts, "rescale", level);
+    // The weights are encrypted at the level of the adjustment (level - 1), so they are added without a mod-switch
+    Count(counts, "add", weight_level);
+}
+
+double Seconds(const OpTable &counts, const OpTable &latencies)
+{
+    double seconds = 0;
+    for (auto &op : counts)
+    {
+        auto latency = latencies.find(op.first);
+        if (latency == latencies.end())
+        {
+            throw runtime_error("no latency for " + op.first);
+        }
+        for (size_t level = 0; level < op.second.size(); ++level)
+        {
+            seconds += op.second[level] * latency->second[level];
+        }
+    }
+    return seconds;
+}
+
+void AddCounts(OpTable &counts, const OpTable &more)
+{
+    for (auto &op : more)
+    {
+        for (size_t level = 0; level < op.second.size(); ++level)
+        {
+            Count(counts, op.first, level, op.second[level]);
+        }
+    }
+}
+
+OpTable EmptyOpTable(size_t top_level)
+{
+    OpTable table;
+    for (const string &op : COST_MODEL_OPS)
+    {
+        table[op] = vector<double>(top_level + 1, 0);
+    }
+    return table;
+}
+
+// Predict one training iteration of config with the coefficient modulus chain of context.
+// For a layout that runs in parallel, the evaluator work on the samples is split over config.thread_count threads,
+// as in GradientSumParallel; the key holder's encryption and decryption and UpdateWeight are serial.
+// Other layouts run on one thread whatever config.thread_count is.
+// Peak memory counts the dataset, the products, one GradientWorkspace per thread and the evaluation keys.
+CostEstimate PlanTraining(SEALContext &context, const OpTable &latencies, const TrainingConfig &config)
+{
+    size_t top_level = TopLevel(context);
+    if (top_level < 5)
+    {
+        throw runtime_error("the Train circuit needs 5 levels");
+    }
+    size_t slot_count = context.first_context_data()->parms().poly_modulus_degree() / 2;
+    double m = double(config.sample_count);
+
+    OpTable serial = EmptyOpTable(top_level);
+    OpTable parallel = EmptyOpTable(top_level);
+    OpTable setup = EmptyOpTable(top_level);
+    size_t dataset_ciphertexts = 0;
+    size_t dataset_level = top_level;
+    size_t product_ciphertexts = 0;
+
+    if (config.layout == "rows" || config.layout == "packed")
+    {
+        // Key holder: one product per sample at the top level, and the weights at the last level
+        Count(serial, "encode", top_level, m);
+        Count(serial, "encrypt", top_level, m);
+        Count(serial, "encode", 0);
+        Count(serial, "encrypt", 0);
+        product_ciphertexts = config.sample_count;
+
+        // Samples and labels are encrypted at the sigmoid output level, so they need no mod-switch
+        size_t level = CountSigmoid(parallel, top_level, m);
+        dataset_level = level;
+        if (config.layout == "rows")
+        {
+            // PartialDerivative
+            Count(parallel, "negate", level, m);
+            Count(parallel, "add", level, m);
+            dataset_ciphertexts = 2 * config.sample_count;
+        }
+        else
+        {
+            // SigmoidProduct, then label_term - sum once
+            Count(serial, "negate", level - 1);
+            Count(serial, "add", level - 1);
+            dataset_ciphertexts = config.sample_count;
+
+            // LabelTerm
+            Count(setup, "add", level, m - 1);
+            Count(setup, "rotate", level);
+            Count(setup, "encode", level);
+            Count(setup, "multiply_plain", level);
+            Count(setup, "rescale", level);
+        }
+        Count(parallel, "multiply", level, m);
+        Count(parallel, "relinearize", level, m);
+        Count(parallel, "rescale", level, m);
+        Count(parallel, "add", level - 1, m - 1);
+
+        // The learning rate is encrypted at the level of the samples
+        CountUpdateWeight(serial, level, 0, level - 1);
+        Count(serial, "decrypt", level - 2);
+    }
+    else if (config.layout == "columns")
+    {
+        double f = double(config.feature_count);
+        double blocks = double((config.sample_count + slot_count - 1) / slot_count);
+
+        // Xw
+        Count(parallel, "encode", top_level, blocks * f);
+        Count(parallel, "multiply_plain", top_level, blocks * f);
+        Count(parallel, "rescale", top_level, blocks * f);
+        Count(parallel, "add", top_level - 1, blocks * (f - 1));
+
+        // residual = y - sigmoid(Xw)
+        size_t level = CountSigmoid(parallel, top_level - 1, blocks);
+        CountModSwitch(parallel, top_level, level, blocks);
+        Count(parallel, "negate", level, blocks);
+        Count(parallel, "add", level, blocks);
+
+        // residual * X_j, summed over blocks and slots
+        CountModSwitch(parallel, top_level, level, blocks * f);
+        Count(parallel, "multiply", level, blocks * f);
+        Count(parallel, "relinearize", level, blocks * f);
+        Count(parallel, "rescale", level, blocks * f);
+        Count(parallel, "add", level - 1, (blocks - 1) * f);
+        size_t rotation_count = 0;
+        for (size_t step = 1; step < slot_count; step <<= 1)
+        {
+            ++rotation_count;
+        }
+        Count(parallel, "rotate", level - 1, rotation_count * f);
+        Count(parallel, "add", level - 1, rotation_count * f);
+
+        Count(serial, "decrypt", level - 1, f);
+        dataset_ciphertexts = size_t(blocks) * (config.feature_count + 1);
+    }
+    else
+    {
+        throw invalid_argument("unknown layout " + config.layout);
+    }
+
+    size_t thread_count = LayoutRunsInParallel(config.layout) ? max<size_t>(1, config.thread_count) : 1;
+    CostEstimate estimate;
+    estimate.counts = serial;
+    AddCounts(estimate.counts, parallel);
+    estimate.seconds_per_iteration = Seconds(serial, latencies) + Seconds(parallel, latencies) / thread_count;
+    estimate.setup_seconds = Seconds(setup, latencies);
+
+    size_t top_bytes = CiphertextBytes(context, top_level);
+    size_t key_level = context.key_context_data()->chain_index();
+    // A relinearization or Galois key holds one ciphertext per data prime, at the key level
+    size_t key_bytes = (top_level + 1) * CiphertextBytes(context, key_level);
+    size_t log_n = 0;
+    while ((size_t(1) << log_n) < 2 * slot_count)
+    {
+        ++log_n;
+    }
+    // main creates the default Galois keys: both directions of every power-of-two step, and conjugation
+    size_t galois_key_count = 2 * (log_n - 1) + 1;
+    // GradientWorkspace holds 12 ciphertexts and 4 plaintexts, at most at the top level
+    size_t workspace_bytes = 12 * top_bytes + 4 * top_bytes / 2;
+
+    estimate.dataset_bytes = dataset_ciphertexts * CiphertextBytes(context, dataset_level);
+    // The products are uploaded at the top level, the weights at the last level where UpdateWeight adds them
+    estimate.upload_bytes_per_iteration = product_ciphertexts * top_bytes + CiphertextBytes(context, 0);
+    estimate.peak_bytes = estimate.dataset_bytes + product_ciphertexts * top_bytes + thread_count * workspace_bytes +
+                          (1 + galois_key_count) * key_bytes;
+    return estimate;
+}
+
+// Measure the latency of every counted operation at every level, averaged over repetitions
+OpTable CalibrateLatencies(SEALContext &context, int repetitions)
+{
+    size_t top_level = TopLevel(context);
+    double scale = pow(2.0, 40);
+    CKKSEncoder encoder(context);
+    Evaluator evaluator(context);
+    KeyGenerator keygen(context);
+    SecretKey secret_key = keygen.secret_key();
+    PublicKey public_key;
+    keygen.create_public_key(public_key);
+    RelinKeys relin_keys;
+    keygen.create_relin_keys(relin_keys);
+    GaloisKeys galois_keys = CreateRotationKeys(keygen, {1});
+    Encryptor encryptor(context, public_key);
+    Decryptor decryptor(context, secret_key);
+
+    OpTable latencies = EmptyOpTable(top_level);
+    vector<double> values(encoder.slot_count(), 0.5);
+    Plaintext plain;
+    encoder.encode(values, scale, plain);
+    Ciphertext x;
+    encryptor.encrypt(plain, x);
+
+    auto measure = [&](string op, size_t level, function<void()> run)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        for (int r = 0; r < repetitions; ++r)
+        {
+            run();
+        }
+        latencies[op][level] = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count() / repetitions;
+    };
+
+    for (size_t level = top_level + 1; level-- > 0;)
+    {
+        parms_id_type parms_id = x.parms_id();
+        Plaintext plain_at_level;
+        Ciphertext y = x, product;
+        measure("encode", level, [&]()
+             { encoder.encode(values, parms_id, scale, plain_at_level); });
+        measure("encrypt", level, [&]()
+             { encryptor.encrypt(plain, y); });
+        y = x;
+        measure("decrypt", level, [&]()
+             { decryptor.decrypt(x, plain); });
+        measure("add", level, [&]()
+             { evaluator.add(x, y, product); });
+        measure("negate", level, [&]()
+             { evaluator.negate(x, product); });
+        measure("multiply_plain", level, [&]()
+             { evaluator.multiply_plain(x, plain_at_level, product); });
+        measure("multiply", level, [&]()
+             { evaluator.multiply(x, y, product); });
+        Ciphertext unrelinearized = product;
+        measure("relinearize", level, [&]()
+             { evaluator.relinearize(unrelinearized, relin_keys, product); });
+        measure("rotate", level, [&]()
+             { evaluator.rotate_vector(x, 1, galois_keys, product); });
+        if (level > 0)
+        {
+            measure("rescale", level, [&]()
+                 { evaluator.rescale_to_next(unrelinearized, product); });
+            measure("mod_switch", level, [&]()
+                 { evaluator.mod_switch_to_next(x, product); });
+            evaluator.mod_switch_to_next_inplace(x);
+        }
+    }
+    return latencies;
+}
+
+void WriteLatenciesToCSV(string filename, const OpTable &latencies)
+{
+    fstream fout;
+    fout.open(filename, ios::out);
+    fout << "op,level,seconds" << endl;
+    for (auto &op : latencies)
+    {
+        for (size_t level = 0; level < op.second.size(); ++level)
+        {
+            fout << op.first << "," << level << "," << op.second[level] << endl;
+        }
+    }
+    fout.close();
+}
+
+OpTable ReadLatenciesFromCSV(string filename, size_t top_level)
+{
+    fstream fin;
+    fin.open(filename, ios::in);
+    OpTable latencies = EmptyOpTable(top_level);
+    string line, op, level, seconds;
+    getline(fin, line);
+    while (getline(fin, line))
+    {
+        stringstream ssline(line);
+        getline(ssline, op, ',');
+        getline(ssline, level, ',');
+        getline(ssline, seconds, ',');
+        latencies[op][stoul(level)] = stod(seconds);
+    }
+    fin.close();
+    return latencies;
+}
+
+// Calibration takes a few seconds and only depends on the machine and the parameters, so it is cached
+// in one file per coefficient modulus chain, e.g. weights/latencies_60-40-40-40-40-40-60.csv for prefix weights/latencies
+OpTable LoadOrCalibrateLatencies(string prefix, SEALContext &context)
+{
+    string filename = prefix;
+    for (const Modulus &modulus : context.key_context_data()->parms().coeff_modulus())
+    {
+        filename += (filename == prefix ? "_" : "-") + to_string(modulus.bit_count());
+    }
+    filename += ".csv";
+    if (filesystem::exists(filename))
+    {
+        return ReadLatenciesFromCSV(filename, TopLevel(context));
+    }
+    OpTable latencies = CalibrateLatencies(context, 10);
+    WriteLatenciesToCSV(filename, latencies);
+    return latencies;
+}
+
+void PrintEstimate(const TrainingConfig &config, const CostEstimate &estimate)
+{
+    double total_ops = 0;
+    for (auto &op : estimate.counts)
+    {
+        for (double count : op.second)
+        {
+            total_ops += count;
+        }
+    }
+    cout << config.layout << "\t" << config.sample_count << " x " << config.feature_count << ", " << config.thread_count << " threads\t"
+         << "Time per iteration: " << estimate.seconds_per_iteration << "s\t"
+         << "Setup: " << estimate.setup_seconds << "s\t"
+         << "Operations: " << size_t(total_ops) << "\t"
+         << "Peak memory: " << estimate.peak_bytes / (1024 * 1024) << " MB\t"
+         << "Dataset: " << estimate.dataset_bytes / (1024 * 1024) << " MB\t"
+         << "Upload per iteration: " << estimate.upload_bytes_per_iteration / (1024 * 1024) << " MB" << endl;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <iostream>
+#include <string>
+
+#include "seal/seal.h"
+using namespace std;
+using namespace seal;
+
+// Whether the CPU running this process supports the feature, as named by __builtin_cpu_supports
+bool CpuSupports(string feature)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (feature == "avx2")
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (feature == "avx512f")
+    {
+        return __builtin_cpu_supports("avx512f");
+    }
+    if (feature == "avx512dq")
+    {
+        return __builtin_cpu_supports("avx512dq");
+    }
+    if (feature == "avx512ifma")
+    {
+        return __builtin_cpu_supports("avx512ifma");
+    }
+#endif
+    return false;
+}
+
+// Print how SEAL was built and which NTT / modular arithmetic kernel each prime of the coefficient modulus runs on.
+// With HEXL, primes below 50 bits use the AVX512-IFMA kernels when the CPU has them,
+// the other primes use the AVX512-DQ kernels; without HEXL (or AVX-512) SEAL uses its portable 64-bit code.
+void PrintKernelReport(SEALContext &context)
+{
+    cout << "/" << endl;
+    cout << "| Kernels :" << endl;
+    cout << "|   SEAL version: " << SEAL_VERSION << endl;
+#ifdef SEAL_USE_INTEL_HEXL
+    bool hexl = true;
+#else
+    bool hexl = false;
+#endif
+    cout << "|   Intel HEXL: " << (hexl ? "on" : "off") << endl;
+
+    cout << "|   CPU: avx2=" << CpuSupports("avx2") << " avx512f=" << CpuSupports("avx512f")
+         << " avx512dq=" << CpuSupports("avx512dq") << " avx512ifma=" << CpuSupports("avx512ifma") << endl;
+
+    cout << "|   compiled for:";
+#ifdef __AVX2__
+    cout << " avx2";
+#endif
+#ifdef __AVX512F__
+    cout << " avx512f";
+#endif
+#ifdef __AVX512IFMA__
+    cout << " avx512ifma";
+#endif
+    cout << endl;
+
+    auto &coeff_modulus = context.key_context_data()->parms().coeff_modulus();
+    for (size_t i = 0; i < coeff_modulus.size(); ++i)
+    {
+        int bit_count = coeff_modulus[i].bit_count();
+        string kernel = "portable";
+        if (hexl && bit_count < 50 && CpuSupports("avx512ifma"))
+        {
+            kernel = "HEXL AVX512-IFMA";
+        }
+        else if (hexl && CpuSupports("avx512dq"))
+        {
+            kernel = "HEXL AVX512-DQ";
+        }
+        cout << "|   prime " << i << " (" << bit_count << " bits): " << kernel << endl;
+    }
+    cout << "\\" << endl;
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "plain_algorithms.hpp"
+#include "packing.hpp"
+using namespace std;
+using namespace seal;
+
+struct FoldResult
+{
+    double accuracy;
+    double seconds;
+    vector<double> weights;
+};
+
+// Row i is held out by fold (i % fold_count).
+// masks[f][i] is 1 if row i is in the training set of fold f, 0 if it is held out.
+// Every fold needs a held-out row and a training row, so 2 <= fold_count <= sample_count.
+vector<vector<double>> FoldMasks(size_t sample_count, size_t fold_count)
+{
+    if (fold_count < 2 || fold_count > sample_count)
+    {
+        throw invalid_argument("the number of folds must be between 2 and the number of samples");
+    }
+    vector<vector<double>> masks(fold_count, vector<double>(sample_count, 1));
+    for (size_t i = 0; i < sample_count; ++i)
+    {
+        masks[i % fold_count][i] = 0;
+    }
+    return masks;
+}
+
+// Train one fold on its masked rows of the already encrypted dataset and evaluate it on the held-out rows
+FoldResult TrainFold(SEALContext &context, PublicKey &public_key, SecretKey &secret_key, RelinKeys &relin_keys, GaloisKeys &galois_keys,
+                     double scale, const vector<vector<double>> &features, const vector<double> &labels,
+                     const vector<Ciphertext> &packed_samples, const Ciphertext &encrypted_learning_rate,
+                     const vector<double> &initial_weights, const vector<double> &mask, int max_iter)
+{
+    CKKSEncoder encoder(context);
+    size_t slot_count = encoder.slot_count();
+    vector<double> weights = initial_weights;
+    GradientWorkspace workspace(context);
+
+    // The label part of the gradient only depends on the training rows of the fold
+    Ciphertext label_term = LabelTerm(context, galois_keys, scale, packed_samples, mask, BlockSize(features[0].size()));
+
+    auto start = chrono::steady_clock::now();
+    for (int iteration = 1; iteration <= max_iter; ++iteration)
+    {
+        // Only the training rows need a product
+        vector<Ciphertext> encrypted_products(features.size());
+        for (size_t i = 0; i < features.size(); ++i)
+        {
+            if (mask[i] == 0)
+            {
+                continue;
+            }
+            double product = PlainVectorMultiplication(features[i], weights);
+            Plaintext plain_product;
+            Encode(encoder, product, scale, plain_product);
+            encrypted_products[i] = Encrypt(context, public_key, scale, plain_product);
+        }
+
+        Plaintext plain_weights;
+        Encode(encoder, weights, scale, plain_weights);
+        Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+
+        Ciphertext encrypted_trained_weights = Train(context, relin_keys, galois_keys, scale, encrypted_products, packed_samples, label_term,
+                                                     encrypted_weights, encrypted_learning_rate, slot_count, mask, workspace);
+
+        Plaintext plain_trained_weights = Decrypt(context, secret_key, encrypted_trained_weights);
+        Decode(encoder, plain_trained_weights, weights);
+        weights.resize(features[0].size());
+    }
+
+    FoldResult result;
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    result.weights = weights;
+
+    vector<vector<double>> held_out_features;
+    vector<double> held_out_labels;
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        if (mask[i] == 0)
+        {
+            held_out_features.push_back(features[i]);
+            held_out_labels.push_back(labels[i]);
+        }
+    }
+    result.accuracy = ComputeAccuracy(held_out_features, held_out_labels, weights);
+    return result;
+}
+
+// k-fold cross-validation over the encrypted dataset.
+// Folds only differ in their masks, so no sample is re-encrypted or copied.
+// Every fold holds its own workspace while it trains, so at most hardware_concurrency() folds train at once,
+// each worker thread taking the next fold when it is done.
+vector<FoldResult> CrossValidate(SEALContext &context, PublicKey &public_key, SecretKey &secret_key, RelinKeys &relin_keys, GaloisKeys &galois_keys,
+                                 double scale, const vector<vector<double>> &features, const vector<double> &labels,
+                                 const vector<Ciphertext> &packed_samples, const Ciphertext &encrypted_learning_rate, const vector<double> &initial_weights, size_t fold_count, int max_iter)
+{
+    vector<vector<double>> masks = FoldMasks(features.size(), fold_count);
+    vector<FoldResult> results(fold_count);
+
+    size_t thread_count = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), fold_count));
+    atomic<size_t> next_fold(0);
+    vector<thread> workers;
+    for (size_t t = 0; t < thread_count; ++t)
+    {
+        workers.emplace_back([&]()
+                             {
+                                 for (size_t f = next_fold++; f < fold_count; f = next_fold++)
+                                 {
+                                     results[f] = TrainFold(context, public_key, secret_key, relin_keys, galois_keys, scale, features, labels,
+                                                            packed_samples, encrypted_learning_rate, initial_weights, masks[f], max_iter);
+                                 } });
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+    {
+        workers[t].join();
+    }
+
+    double mean_accuracy = 0;
+    for (size_t f = 0; f < fold_count; ++f)
+    {
+        cout << "Fold #" << f + 1 << "\t\tTraining time: " << results[f].seconds << "s\t\tHeld-out accuracy: " << results[f].accuracy << endl;
+        mean_accuracy += results[f].accuracy / fold_count;
+    }
+    cout << "Mean held-out accuracy: " << mean_accuracy << endl;
+    return results;
+}
@@ -1,10 +1,36 @@
+#pragma once
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <sstream>
+#include <functional>
+#include <filesystem>
+#include <stdexcept>
 using namespace std;
 
+// Write to a temporary file and rename it over filename once complete,
+// so that a crash leaves either the previous file or the new one, never a partial file.
+// The temporary file gets permissions before anything is written to it, unless they are unknown.
+void WriteFileAtomically(string filename, const function<void(ostream &)> &write,
+                         filesystem::perms permissions = filesystem::perms::unknown)
+{
+    string temp_filename = filename + ".tmp";
+    fstream fout;
+    fout.open(temp_filename, ios::out | ios::binary | ios::trunc);
+    if (permissions != filesystem::perms::unknown)
+    {
+        filesystem::permissions(temp_filename, permissions);
+    }
+    write(fout);
+    fout.close();
+    if (fout.fail())
+    {
+        throw runtime_error("cannot write " + temp_filename);
+    }
+    filesystem::rename(temp_filename, filename);
+}
+
 vector<vector<double>> ReadDatasetFromCSV(string filename)
 {
     fstream fin;
@@ -17,16 +43,20 @@ vector<vector<double>> ReadDatasetFromCSV(string filename)
 
     // get rid of the header row
     getline(fin, line);
-    while (fin.good())
+    // read 1 line
+    while (getline(fin, line))
     {
+        // skip blank lines, such as the one after the trailing newline
+        if (line.empty() || line == "\r")
+        {
+            continue;
+        }
+
         row.clear();
 
         // Add bias
         row.push_back(1);
 
-        // read 1 line
-        getline(fin, line);
-
         // put the line to stream
         stringstream ssline(line);
 
@@ -47,22 +77,20 @@ vector<vector<double>> ReadDatasetFromCSV(string filename)
 }
 
 // Write to a csv file
-// If the file exists, its contents will be overwritten
+// If the file exists, it is replaced atomically
 // Otherwise, create a new file and write to it
 void WriteWeightsToCSV(string filename, const vector<double> &data)
 {
-    fstream fout;
-    fout.open(filename, ios::out);
-
-    for (int i = 0; i < data.size(); ++i)
-    {
-        fout << data[i];
-        if (i < data.size() - 1)
-        {
-            fout << ",";
-        }
-    }
-    fout.close();
+    WriteFileAtomically(filename, [&](ostream &fout)
+                        {
+                            for (size_t i = 0; i < data.size(); ++i)
+                            {
+                                fout << data[i];
+                                if (i + 1 < data.size())
+                                {
+                                    fout << ",";
+                                }
+                            } });
 }
 
 vector<double> ReadWeightsFromCSV(string filename)
@@ -88,25 +116,6 @@ vector<double> ReadWeightsFromCSV(string filename)
     return weights;
 }
 
-int ReadCheckpointFromFile(string filename)
-{
-    fstream fin;
-    fin.open(filename, ios::in);
-
-    int saved_iteration;
-    fin >> saved_iteration;
-    fin.close();
-    return saved_iteration;
-}
-
-void WriteCheckpointToFile(string filename, int iteration)
-{
-    fstream fout;
-    fout.open(filename, ios::out);
-    fout << iteration;
-    fout.close();
-}
-
 vector<double> ExtractLabel(vector<vector<double>> &dataset, int col_idx)
 {
     vector<double> labels;
@@ -117,3 +126,24 @@ vector<double> ExtractLabel(vector<vector<double>> &dataset, int col_idx)
     }
     return labels;
 }
+
+
+// Write a dataset to a csv file with the given header row
+void WriteDatasetToCSV(string filename, const vector<string> &header, const vector<vector<double>> &dataset)
+{
+    fstream fout;
+    fout.open(filename, ios::out);
+
+    for (size_t i = 0; i < header.size(); ++i)
+    {
+        fout << header[i] << (i < header.size() - 1 ? "," : "\n");
+    }
+    for (size_t i = 0; i < dataset.size(); ++i)
+    {
+        for (size_t j = 0; j < dataset[i].size(); ++j)
+        {
+            fout << dataset[i][j] << (j < dataset[i].size() - 1 ? "," : "\n");
+        }
+    }
+    fout.close();
+}
@@ -0,0 +1,367 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <stdexcept>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "streaming.hpp"
+#include "transport.hpp"
+#include "keystore.hpp"
+#include "plain_algorithms.hpp"
+using namespace std;
+using namespace seal;
+
+// Data-parallel training over several processes.
+// Every worker loads its own partition of the encrypted dataset file and returns the encrypted
+// gradient sum of that partition; the coordinator adds the partial sums and applies UpdateWeight.
+// Workers and coordinator talk over a local socket with length-prefixed messages:
+//     coordinator -> worker: "<dataset file> <offset> <count> <scale> <key store> <key fingerprint>"
+//     every iteration:       the products of the partition -> the partial gradient sum
+//     an empty message stops the worker.
+// Ciphertexts travel in the transport format, at the level their receiver uses them at.
+// The coordinator already holds the secret key when it forks, so every worker execs a fresh copy of the program
+// ("main worker <socket>") instead of running in the forked image: the worker process never has the secret key
+// in its memory. Workers map the relinearization keys from the coordinator's key store (see keystore.hpp) rather than
+// receiving a copy each, and check that the store belongs to the coordinator's secret key.
+
+void WriteAll(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written <= 0)
+        {
+            throw runtime_error("socket write failed");
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+void ReadAll(int fd, char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t received = read(fd, data, size);
+        if (received <= 0)
+        {
+            throw runtime_error("socket read failed");
+        }
+        data += received;
+        size -= received;
+    }
+}
+
+void SendMessage(int fd, const string &message)
+{
+    uint64_t size = message.size();
+    WriteAll(fd, reinterpret_cast<const char *>(&size), sizeof(size));
+    WriteAll(fd, message.data(), message.size());
+}
+
+string ReceiveMessage(int fd)
+{
+    uint64_t size;
+    ReadAll(fd, reinterpret_cast<char *>(&size), sizeof(size));
+    string message(size, '\0');
+    ReadAll(fd, &message[0], size);
+    return message;
+}
+
+void SendCiphertext(SEALContext &context, int fd, const Ciphertext &ciphertext, parms_id_type consumer_parms_id)
+{
+    stringstream message;
+    SaveTransport(context, ciphertext, consumer_parms_id, message);
+    SendMessage(fd, message.str());
+}
+
+Ciphertext ReceiveCiphertext(SEALContext &context, int fd, parms_id_type expected_parms_id)
+{
+    stringstream message(ReceiveMessage(fd));
+    return LoadTransport(context, message, expected_parms_id);
+}
+
+sockaddr_un SocketAddress(string socket_path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    socket_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+    return address;
+}
+
+// A socket path in a new directory that only this user can enter, so that no other user can predict or take it
+string CreateSocketPath()
+{
+    char directory[] = "/tmp/helr-XXXXXX";
+    if (mkdtemp(directory) == nullptr)
+    {
+        throw runtime_error("cannot create a socket directory in /tmp");
+    }
+    return string(directory) + "/coordinator.sock";
+}
+
+void RemoveSocketPath(string socket_path)
+{
+    unlink(socket_path.c_str());
+    rmdir(socket_path.substr(0, socket_path.rfind('/')).c_str());
+}
+
+// Worker process: connect to the coordinator, load the partition and answer gradient requests until stopped
+void RunWorker(string socket_path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        throw runtime_error("cannot create a socket");
+    }
+    sockaddr_un address = SocketAddress(socket_path);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        throw runtime_error("cannot connect to " + socket_path);
+    }
+
+    SEALContext context = SetupCKKS();
+    stringstream partition_message(ReceiveMessage(fd));
+    string dataset_filename, key_store_filename;
+    streamoff offset;
+    size_t sample_count;
+    double scale;
+    uint64_t key_fingerprint;
+    partition_message >> dataset_filename >> offset >> sample_count >> scale >> key_store_filename >> key_fingerprint;
+
+    KeyStore store(key_store_filename, context);
+    if (store.key_fingerprint != key_fingerprint)
+    {
+        throw runtime_error(key_store_filename + " belongs to another secret key");
+    }
+    RelinKeys relin_keys;
+    LoadFromKeyStore(context, store, relin_keys);
+
+    // Load this worker's partition of the encrypted dataset
+    fstream dataset;
+    dataset.open(dataset_filename, ios::in | ios::binary);
+    if (!dataset.is_open())
+    {
+        throw runtime_error("cannot open " + dataset_filename);
+    }
+    dataset.seekg(offset);
+    vector<Ciphertext> samples, labels;
+    for (size_t i = 0; i < sample_count; ++i)
+    {
+        samples.push_back(LoadCiphertext(context, dataset));
+        labels.push_back(LoadCiphertext(context, dataset));
+    }
+    dataset.close();
+
+    GradientWorkspace workspace(context);
+    vector<double> mask(sample_count, 1);
+    while (true)
+    {
+        string products_message = ReceiveMessage(fd);
+        if (products_message.empty())
+        {
+            break;
+        }
+        stringstream products_stream(products_message);
+        vector<Ciphertext> encrypted_products;
+        for (size_t i = 0; i < sample_count; ++i)
+        {
+            encrypted_products.push_back(LoadTransport(context, products_stream, context.first_parms_id()));
+        }
+
+        Ciphertext partial_sum = GradientSum(context, relin_keys, scale, encrypted_products, samples, labels, mask, workspace);
+        SendCiphertext(context, fd, partial_sum, GradientParmsId(context));
+    }
+    close(fd);
+}
+
+// Stop the workers forked so far, when the coordinator cannot go on
+void AbortWorkers(const vector<pid_t> &worker_pids, const vector<int> &worker_fds, int listen_fd, string socket_path)
+{
+    for (int fd : worker_fds)
+    {
+        close(fd);
+    }
+    for (pid_t pid : worker_pids)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    close(listen_fd);
+    RemoveSocketPath(socket_path);
+}
+
+// Coordinator: start worker_count workers over the encrypted dataset file and train max_iter iterations.
+// key_store_filename must hold the evaluation keys of secret_key.
+// Every worker gets at least one sample, so there are at most features.size() workers.
+// seconds_per_iteration receives the average time from sending the products to the updated weights.
+vector<double> TrainDistributed(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key, RelinKeys &relin_keys,
+                                string key_store_filename, double scale, const vector<vector<double>> &features, vector<double> weights,
+                                double learning_rate, string dataset_filename, const vector<streamoff> &record_offsets,
+                                size_t worker_count, int max_iter, double &seconds_per_iteration)
+{
+    if (features.empty() || worker_count == 0)
+    {
+        throw invalid_argument("distributed training needs at least one sample and one worker");
+    }
+    worker_count = min(worker_count, features.size());
+
+    string socket_path = CreateSocketPath();
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        RemoveSocketPath(socket_path);
+        throw runtime_error("cannot create a socket");
+    }
+    sockaddr_un address = SocketAddress(socket_path);
+    if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listen_fd, worker_count) != 0)
+    {
+        close(listen_fd);
+        RemoveSocketPath(socket_path);
+        throw runtime_error("cannot listen on " + socket_path);
+    }
+
+    // Workers are accepted in the order they are forked, so worker_fds[w] is worker w
+    vector<pid_t> worker_pids;
+    vector<int> worker_fds;
+    for (size_t w = 0; w < worker_count; ++w)
+    {
+        cout.flush();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listen_fd);
+            execl("/proc/self/exe", "main", "worker", socket_path.c_str(), nullptr);
+            cerr << "Worker " << w << ": cannot exec /proc/self/exe" << endl;
+            _exit(1);
+        }
+        if (pid < 0)
+        {
+            AbortWorkers(worker_pids, worker_fds, listen_fd, socket_path);
+            throw runtime_error("cannot fork worker " + to_string(w));
+        }
+        worker_pids.push_back(pid);
+        int worker_fd = accept(listen_fd, nullptr, nullptr);
+        if (worker_fd < 0)
+        {
+            AbortWorkers(worker_pids, worker_fds, listen_fd, socket_path);
+            throw runtime_error("cannot accept worker " + to_string(w));
+        }
+        worker_fds.push_back(worker_fd);
+    }
+
+    // Hand out the partitions
+    vector<size_t> partition_begin(worker_count + 1);
+    for (size_t w = 0; w <= worker_count; ++w)
+    {
+        partition_begin[w] = w * features.size() / worker_count;
+    }
+    for (size_t w = 0; w < worker_count; ++w)
+    {
+        stringstream partition_message;
+        partition_message << setprecision(17) << dataset_filename << " " << record_offsets[partition_begin[w]] << " "
+                          << partition_begin[w + 1] - partition_begin[w] << " " << scale << " " << key_store_filename << " "
+                          << KeyFingerprint(secret_key);
+        SendMessage(worker_fds[w], partition_message.str());
+    }
+
+    Plaintext plain_learning_rate;
+    Encode(encoder, learning_rate, SampleParmsId(context), scale, plain_learning_rate);
+    Ciphertext encrypted_learning_rate = Encrypt(context, public_key, scale, plain_learning_rate);
+    Evaluator evaluator(context);
+
+    double total_seconds = 0;
+    for (int iteration = 1; iteration <= max_iter; ++iteration)
+    {
+        // Encrypt the products of every partition
+        vector<string> products_messages(worker_count);
+        for (size_t w = 0; w < worker_count; ++w)
+        {
+            stringstream products_stream;
+            for (size_t i = partition_begin[w]; i < partition_begin[w + 1]; ++i)
+            {
+                Plaintext plain_product;
+                Encode(encoder, PlainVectorMultiplication(features[i], weights), scale, plain_product);
+                SaveTransport(context, Encrypt(context, public_key, scale, plain_product), context.first_parms_id(), products_stream);
+            }
+            products_messages[w] = products_stream.str();
+        }
+        Plaintext plain_weights;
+        Encode(encoder, weights, context.last_parms_id(), scale, plain_weights);
+        Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+
+        auto start = chrono::steady_clock::now();
+        for (size_t w = 0; w < worker_count; ++w)
+        {
+            SendMessage(worker_fds[w], products_messages[w]);
+        }
+
+        // Add the encrypted partial gradients of all workers
+        Ciphertext encrypted_derivatives_sum = ReceiveCiphertext(context, worker_fds[0], GradientParmsId(context));
+        for (size_t w = 1; w < worker_count; ++w)
+        {
+            evaluator.add_inplace(encrypted_derivatives_sum, ReceiveCiphertext(context, worker_fds[w], GradientParmsId(context)));
+        }
+        encrypted_derivatives_sum.scale() = scale;
+        Ciphertext encrypted_trained_weights = UpdateWeight(context, relin_keys, scale, encrypted_derivatives_sum, features.size(),
+                                                            encrypted_weights, encrypted_learning_rate);
+        total_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        Plaintext plain_trained_weights = Decrypt(context, secret_key, encrypted_trained_weights);
+        Decode(encoder, plain_trained_weights, weights);
+        weights.resize(features[0].size());
+    }
+    seconds_per_iteration = total_seconds / max_iter;
+
+    for (size_t w = 0; w < worker_count; ++w)
+    {
+        SendMessage(worker_fds[w], "");
+        close(worker_fds[w]);
+        waitpid(worker_pids[w], nullptr, 0);
+    }
+    close(listen_fd);
+    RemoveSocketPath(socket_path);
+    return weights;
+}
+
+// Train with 1 to max_workers worker processes from the same initial weights and report the scaling efficiency,
+// time(1 worker) / (n * time(n workers)). There are never more workers than samples.
+vector<double> TrainDistributedScaling(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key,
+                                       RelinKeys &relin_keys, string key_store_filename, double scale, vector<vector<double>> &features, vector<double> &labels,
+                                       const vector<double> &initial_weights, double learning_rate, size_t max_workers, int max_iter)
+{
+    string dataset_filename = "dataset/encrypted_dataset.bin";
+    vector<streamoff> record_offsets;
+    WriteEncryptedDataset(dataset_filename, context, encoder, secret_key, scale, features, labels, record_offsets);
+
+    vector<double> weights;
+    double single_worker_seconds = 0;
+    max_workers = min(max_workers, features.size());
+    for (size_t worker_count = 1; worker_count <= max_workers; ++worker_count)
+    {
+        double seconds_per_iteration;
+        weights = TrainDistributed(context, encoder, public_key, secret_key, relin_keys, key_store_filename, scale, features, initial_weights,
+                                   learning_rate, dataset_filename, record_offsets, worker_count, max_iter, seconds_per_iteration);
+        if (worker_count == 1)
+        {
+            single_worker_seconds = seconds_per_iteration;
+        }
+        cout << "Workers: " << worker_count << "\t\tTime per iteration: " << seconds_per_iteration << "s\t\t"
+             << "Efficiency: " << single_worker_seconds / (worker_count * seconds_per_iteration) << "\t\t"
+             << "Train accuracy: " << ComputeAccuracy(features, labels, weights) << endl;
+    }
+    return weights;
+}
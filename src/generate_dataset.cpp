@@ -0,0 +1,36 @@
+#include <iostream>
+#include <string>
+
+#include "data_preprocessing.hpp"
+#include "synthetic.hpp"
+using namespace std;
+
+// Usage: generate_dataset <rows> <features> [positive ratio] [seed] [output csv]
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        cout << "Usage: " << argv[0] << " <rows> <features> [positive ratio] [seed] [output csv]" << endl;
+        return 1;
+    }
+    size_t row_count = stoul(argv[1]);
+    size_t feature_count = stoul(argv[2]);
+    double positive_ratio = argc > 3 ? stod(argv[3]) : 0.5;
+    unsigned int seed = argc > 4 ? stoul(argv[4]) : 0;
+    string filename = argc > 5 ? argv[5] : "dataset/synthetic.csv";
+
+    vector<vector<double>> dataset;
+    try
+    {
+        dataset = GenerateDataset(row_count, feature_count, positive_ratio, seed);
+    }
+    catch (invalid_argument &e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    WriteDatasetToCSV(filename, SyntheticHeader(feature_count), dataset);
+    cout << "Wrote " << row_count << " rows of " << feature_count << " features to " << filename << endl;
+
+    return 0;
+}
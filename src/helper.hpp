@@ -1,3 +1,4 @@
+#pragma once
 #include "seal/seal.h"
 #include <iostream>
 #include <iomanip>
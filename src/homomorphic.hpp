@@ -1,18 +1,23 @@
+#pragma once
 #include "seal/seal.h"
 #include "helper.hpp"
 #include <iostream>
 #include <vector>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
 using namespace std;
 using namespace seal;
 
-SEALContext SetupCKKS()
+// The training circuit is laid out for the default chain, {60, 40 x 5, 60}: 5 levels below the top one.
+// The cost model plans other chains with the second form.
+SEALContext SetupCKKS(size_t poly_modulus_degree, const vector<int> &coeff_modulus_bits)
 {
     EncryptionParameters parms(scheme_type::ckks);
-    size_t poly_modulus_degree = 16384;
     parms.set_poly_modulus_degree(poly_modulus_degree);
     try
     {
-        parms.set_coeff_modulus(CoeffModulus::Create(poly_modulus_degree, {60, 40, 40, 40, 40, 40, 60}));
+        parms.set_coeff_modulus(CoeffModulus::Create(poly_modulus_degree, coeff_modulus_bits));
     }
     catch (exception e)
     {
@@ -22,6 +27,11 @@ SEALContext SetupCKKS()
     return SEALContext(parms);
 }
 
+SEALContext SetupCKKS()
+{
+    return SetupCKKS(16384, {60, 40, 40, 40, 40, 40, 60});
+}
+
 Ciphertext Encrypt(SEALContext &context, PublicKey &public_key, double &scale, Plaintext &plaintext)
 {
     Encryptor encryptor(context, public_key);
@@ -30,6 +40,32 @@ Ciphertext Encrypt(SEALContext &context, PublicKey &public_key, double &scale, P
     return ciphertext;
 }
 
+// Symmetric-key encryption for the data owner, who also holds the secret key.
+// Until it is saved, the result only stores the seed of the random half of the ciphertext,
+// so its serialized form is about half the size of a public-key ciphertext.
+Serializable<Ciphertext> EncryptSymmetric(SEALContext &context, SecretKey &secret_key, Plaintext &plaintext)
+{
+    Encryptor encryptor(context, secret_key);
+    return encryptor.encrypt_symmetric(plaintext);
+}
+
+// Symmetrically encrypt the plaintext and write the seeded ciphertext to out.
+// Return the number of bytes written.
+streamoff EncryptSymmetricToStream(SEALContext &context, SecretKey &secret_key, Plaintext &plaintext, ostream &out,
+                                   compr_mode_type compr_mode = Serialization::compr_mode_default)
+{
+    return EncryptSymmetric(context, secret_key, plaintext).save(out, compr_mode);
+}
+
+// Read back a ciphertext written by EncryptSymmetricToStream or Ciphertext::save.
+// A seeded ciphertext is expanded to its full size here.
+Ciphertext LoadCiphertext(SEALContext &context, istream &in)
+{
+    Ciphertext ciphertext;
+    ciphertext.load(context, in);
+    return ciphertext;
+}
+
 Plaintext Decrypt(SEALContext &context, SecretKey &secret_key, Ciphertext &ciphertext)
 {
     Decryptor decryptor(context, secret_key);
@@ -53,6 +89,17 @@ void Encode(CKKSEncoder &encoder, double input, double &scale, Plaintext &output
     encoder.encode(input, scale, output);
 }
 
+// Encode at the level of parms_id, so that the ciphertext encrypted from it is only as large as that level needs
+void Encode(CKKSEncoder &encoder, vector<double> &input, parms_id_type parms_id, double &scale, Plaintext &output)
+{
+    encoder.encode(input, parms_id, scale, output);
+}
+
+void Encode(CKKSEncoder &encoder, double input, parms_id_type parms_id, double &scale, Plaintext &output)
+{
+    encoder.encode(input, parms_id, scale, output);
+}
+
 void Encode(SEALContext &context, vector<double> &input, double &scale, Plaintext &output)
 {
     CKKSEncoder encoder(context);
@@ -71,8 +118,34 @@ void Encode(SEALContext &context, double input, double &scale, Plaintext &output
     Encode(encoder, input, scale, output);
 }
 
+// parms_id of the ciphertexts at level (chain index)
+parms_id_type ParmsIdAtLevel(SEALContext &context, size_t level)
+{
+    auto context_data = context.first_context_data();
+    while (context_data->chain_index() > level)
+    {
+        context_data = context_data->next_context_data();
+    }
+    return context_data->parms_id();
+}
+
+// Level plan of Train: the products enter Sigmoid at the top level, and samples and labels are first used
+// by PartialDerivative on the sigmoid output, 3 levels lower (Level 2).
+// Samples and labels encrypted at that level are half the size of top-level ones and cheaper to encrypt.
+parms_id_type SampleParmsId(SEALContext &context)
+{
+    return ParmsIdAtLevel(context, context.first_context_data()->chain_index() - 3);
+}
+
+// Level of the gradient sums that UpdateWeight takes (Level 1), one level below the samples
+parms_id_type GradientParmsId(SEALContext &context)
+{
+    return ParmsIdAtLevel(context, context.first_context_data()->chain_index() - 4);
+}
+
 // Perform sigmoid function on the x_encrypted (Level 5)
 // The Ciphertext output will be a "spread" result (Level 2)
+// A lower input level works as well: the output is always 3 levels below the input.
 Ciphertext Sigmoid(SEALContext &context, RelinKeys &relin_keys, double scale, Ciphertext &x_encrypted)
 {
     Evaluator evaluator(context);
@@ -156,6 +229,8 @@ Ciphertext Sigmoid(SEALContext &context, RelinKeys &relin_keys, double scale, Ci
     Plaintext plain_coeff3;
     Encode(encoder, 0.021, scale, plain_coeff3);
     // plain_coeff3 -> Level 5
+    evaluator.mod_switch_to_inplace(plain_coeff3, x_encrypted_parms_id);
+    // plain_coeff3 -> level of x_encrypted
 
     evaluator.multiply_plain(x_encrypted, plain_coeff3, x_encrypted_coeff3);
     evaluator.rescale_to_next_inplace(x_encrypted_coeff3);
@@ -188,6 +263,8 @@ Ciphertext Sigmoid(SEALContext &context, RelinKeys &relin_keys, double scale, Ci
     Plaintext plain_coeff1;
     Encode(encoder, 0.25, scale, plain_coeff1);
     // plain_coeff1 -> Level 5
+    evaluator.mod_switch_to_inplace(plain_coeff1, x_encrypted_parms_id);
+    // plain_coeff1 -> level of x_encrypted
 
     evaluator.multiply_plain(x_encrypted, plain_coeff1, x_encrypted_coeff1);
     evaluator.rescale_to_next_inplace(x_encrypted_coeff1);
@@ -220,39 +297,107 @@ Ciphertext Sigmoid(SEALContext &context, RelinKeys &relin_keys, double scale, Ci
     return encrypted_final_result;
 }
 
-/*
-// Sum all elements of the given plaintext
-Ciphertext Sum(SEALContext &context, GaloisKeys &galois_keys, const Ciphertext &x_encrypted, size_t slot_count)
+// Rotation steps 1 .. width - 1, which bring every slot of a width-slot row to slot 0
+vector<int> RowRotationSteps(size_t width)
+{
+    vector<int> steps;
+    for (size_t step = 1; step < width; ++step)
+    {
+        steps.push_back(int(step));
+    }
+    return steps;
+}
+
+// Galois keys for exactly the given rotation steps.
+// A step with its own key costs one key switch; with the default power-of-two keys
+// SEAL composes a step such as 7 out of several rotations, each with its own key switch.
+GaloisKeys CreateRotationKeys(KeyGenerator &keygen, const vector<int> &steps)
+{
+    GaloisKeys galois_keys;
+    keygen.create_galois_keys(steps, galois_keys);
+    return galois_keys;
+}
+
+// Rotate x_encrypted by every step and return all rotations, in the order of steps.
+// SEAL 3.6 does not expose the key-switch decomposition, so the rotations cannot share it;
+// instead every step should have its own key (see CreateRotationKeys), and the rotations,
+// which only read x_encrypted, can be spread over thread_count threads. Callers that already run
+// in parallel (the scheduler, ScoreRecords) keep the default of one thread.
+vector<Ciphertext> RotateMany(SEALContext &context, GaloisKeys &galois_keys, const Ciphertext &x_encrypted, const vector<int> &steps,
+                              size_t thread_count = 1)
+{
+    vector<Ciphertext> rotations(steps.size());
+    thread_count = max<size_t>(1, min(thread_count, steps.size()));
+    if (thread_count == 1)
+    {
+        Evaluator evaluator(context);
+        for (size_t i = 0; i < steps.size(); ++i)
+        {
+            evaluator.rotate_vector(x_encrypted, steps[i], galois_keys, rotations[i]);
+        }
+        return rotations;
+    }
+
+    vector<thread> workers;
+    for (size_t t = 0; t < thread_count; ++t)
+    {
+        workers.emplace_back([&, t]()
+                             {
+                                 Evaluator evaluator(context);
+                                 for (size_t i = t; i < steps.size(); i += thread_count)
+                                 {
+                                     evaluator.rotate_vector(x_encrypted, steps[i], galois_keys, rotations[i]);
+                                 } });
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+    }
+    return rotations;
+}
+
+// Sum the first width slots of x_encrypted into slot 0; the other slots hold partial sums.
+// A power-of-two width is reduced by log2(width) rotate-and-add steps of 1, 2, 4, ...
+// Any other width needs every step of RowRotationSteps(width); those rotations all start from
+// x_encrypted, so they are computed at once by RotateMany over thread_count threads.
+Ciphertext Sum(SEALContext &context, GaloisKeys &galois_keys, const Ciphertext &x_encrypted, size_t width, size_t thread_count = 1)
 {
     Evaluator evaluator(context);
 
-    Ciphertext copied_x1 = x_encrypted;
-    Ciphertext copied_x2 = x_encrypted;
-    for (size_t i = 1; i < slot_count; ++i)
+    if ((width & (width - 1)) == 0)
     {
-        evaluator.rotate_vector_inplace(copied_x2, 1, galois_keys);
-        evaluator.add_inplace(copied_x1, copied_x2);
+        Ciphertext encrypted_sum = x_encrypted;
+        Ciphertext rotated;
+        for (size_t step = 1; step < width; step <<= 1)
+        {
+            evaluator.rotate_vector(encrypted_sum, int(step), galois_keys, rotated);
+            evaluator.add_inplace(encrypted_sum, rotated);
+        }
+        return encrypted_sum;
     }
-    return copied_x1;
+
+    vector<Ciphertext> rotations = RotateMany(context, galois_keys, x_encrypted, RowRotationSteps(width), thread_count);
+    rotations.push_back(x_encrypted);
+    Ciphertext encrypted_sum;
+    evaluator.add_many(rotations, encrypted_sum);
+    return encrypted_sum;
 }
 
-// Perform vector multiplication between the x_encrypted (Level 6) and the weights_encrypted (Level 6)
-// The Ciphertext output will be a "spread" sum of the multiplication result (Level 5)
-Ciphertext VectorMultiplication(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, const Ciphertext &x_encrypted, const Ciphertext &weights_encrypted, size_t slot_count)
+// Inner product of two width-slot rows: x_encrypted (Level 5) and weights_encrypted (Level 5)
+// Slot 0 of the output holds the inner product (Level 4)
+Ciphertext VectorMultiplication(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, const Ciphertext &x_encrypted,
+                                const Ciphertext &weights_encrypted, size_t width)
 {
     Evaluator evaluator(context);
 
-    // x1 - Level 6
-    // x2 - Level 6
     Ciphertext encrypted_product;
     evaluator.multiply(x_encrypted, weights_encrypted, encrypted_product);
     evaluator.relinearize_inplace(encrypted_product, relin_keys);
     evaluator.rescale_to_next_inplace(encrypted_product);
-    // encrypted_product -> Level 5
+    // encrypted_product -> Level 4
 
-    return Sum(context, galois_keys, encrypted_product, slot_count);
+    return Sum(context, galois_keys, encrypted_product, width);
 }
-*/
 
 // Perform partial derivative on the sigmoided_value of one single encrypted sample
 // Ciphertext inputs:
@@ -313,18 +458,377 @@ Ciphertext SumPartialDerivative(SEALContext &context, RelinKeys &relin_keys, con
     return encrypted_sum;
 }
 
-// This algorithm is only able to train 1 iteration at a time due to incompatible levels of operands at the end of the algorithm.
-// This function return the new adjusted encrypted weights parameter.
-Ciphertext Train(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale, const vector<Ciphertext> &encrypted_products,
-                 const vector<Ciphertext> &samples, const vector<Ciphertext> &labels,
-                 const Ciphertext &weight, const Ciphertext &learning_rate, size_t slot_count)
+// Buffers of the GradientSum hot loop, reused from one sample and one iteration to the next
+// so that once they have grown to size the loop no longer allocates.
+// Every evaluator call draws its temporaries from pool, which is thread-local by default:
+// use one workspace per thread.
+struct GradientWorkspace
+{
+    Evaluator evaluator;
+    CKKSEncoder encoder;
+    MemoryPoolHandle pool;
+
+    // Sigmoid coefficients, encoded once for the level of the products
+    Plaintext plain_coeff5, plain_coeff3, plain_coeff1, plain_coeff0;
+
+    Ciphertext x_sq, x_quad, x_coeff5, x_pow_5, x_coeff3, x_pow_3, x_coeff1;
+    Ciphertext sigmoid, x, y, partial_derivative, derivatives_sum;
+
+    GradientWorkspace(SEALContext &context, MemoryPoolHandle pool = MemoryManager::GetPool(mm_prof_opt::mm_force_thread_local))
+        : evaluator(context), encoder(context), pool(pool),
+          plain_coeff5(pool), plain_coeff3(pool), plain_coeff1(pool), plain_coeff0(pool),
+          x_sq(pool), x_quad(pool), x_coeff5(pool), x_pow_5(pool), x_coeff3(pool), x_pow_3(pool), x_coeff1(pool),
+          sigmoid(pool), x(pool), y(pool), partial_derivative(pool), derivatives_sum(pool)
+    {
+    }
+};
+
+// Encode the sigmoid coefficients for inputs at x_parms_id, unless they already are
+void PrepareSigmoidCoefficients(SEALContext &context, GradientWorkspace &workspace, double scale, parms_id_type x_parms_id)
+{
+    if (workspace.plain_coeff5.parms_id() == x_parms_id)
+    {
+        return;
+    }
+    // The circuit consumes 3 levels, so x must be at chain index 3 or above
+    auto x_context_data = context.get_context_data(x_parms_id);
+    if (!x_context_data || x_context_data->chain_index() < 3)
+    {
+        throw invalid_argument("sigmoid input is not at a level with 3 levels below it");
+    }
+    workspace.encoder.encode(0.002, x_parms_id, scale, workspace.plain_coeff5, workspace.pool);
+    workspace.encoder.encode(0.021, x_parms_id, scale, workspace.plain_coeff3, workspace.pool);
+    workspace.encoder.encode(0.25, x_parms_id, scale, workspace.plain_coeff1, workspace.pool);
+
+    // The constant term is added 3 levels below the input
+    auto result_context_data = x_context_data->next_context_data()->next_context_data()->next_context_data();
+    workspace.encoder.encode(0.5, result_context_data->parms_id(), scale, workspace.plain_coeff0, workspace.pool);
+}
+
+// Same circuit as Sigmoid, written into workspace.sigmoid without allocating new ciphertexts
+void Sigmoid(RelinKeys &relin_keys, double scale, const Ciphertext &x_encrypted, GradientWorkspace &workspace)
+{
+    Evaluator &evaluator = workspace.evaluator;
+    MemoryPoolHandle &pool = workspace.pool;
+
+    // x_sq -> Level 4
+    evaluator.square(x_encrypted, workspace.x_sq, pool);
+    evaluator.relinearize_inplace(workspace.x_sq, relin_keys, pool);
+    evaluator.rescale_to_next_inplace(workspace.x_sq, pool);
+    workspace.x_sq.scale() = scale;
+
+    // x_quad -> Level 3
+    evaluator.square(workspace.x_sq, workspace.x_quad, pool);
+    evaluator.relinearize_inplace(workspace.x_quad, relin_keys, pool);
+    evaluator.rescale_to_next_inplace(workspace.x_quad, pool);
+    workspace.x_quad.scale() = scale;
+
+    // 0.002x^5 -> Level 2
+    evaluator.multiply_plain(x_encrypted, workspace.plain_coeff5, workspace.x_coeff5, pool);
+    evaluator.rescale_to_next_inplace(workspace.x_coeff5, pool);
+    workspace.x_coeff5.scale() = scale;
+    evaluator.mod_switch_to_inplace(workspace.x_coeff5, workspace.x_quad.parms_id(), pool);
+    evaluator.multiply(workspace.x_quad, workspace.x_coeff5, workspace.x_pow_5, pool);
+    evaluator.relinearize_inplace(workspace.x_pow_5, relin_keys, pool);
+    evaluator.rescale_to_next_inplace(workspace.x_pow_5, pool);
+    workspace.x_pow_5.scale() = scale;
+    parms_id_type last_parms_id = workspace.x_pow_5.parms_id();
+
+    // 0.021x^3 -> Level 2
+    evaluator.multiply_plain(x_encrypted, workspace.plain_coeff3, workspace.x_coeff3, pool);
+    evaluator.rescale_to_next_inplace(workspace.x_coeff3, pool);
+    workspace.x_coeff3.scale() = scale;
+    evaluator.multiply(workspace.x_sq, workspace.x_coeff3, workspace.x_pow_3, pool);
+    evaluator.relinearize_inplace(workspace.x_pow_3, relin_keys, pool);
+    evaluator.rescale_to_next_inplace(workspace.x_pow_3, pool);
+    workspace.x_pow_3.scale() = scale;
+    evaluator.mod_switch_to_inplace(workspace.x_pow_3, last_parms_id, pool);
+
+    // 0.25x -> Level 2
+    evaluator.multiply_plain(x_encrypted, workspace.plain_coeff1, workspace.x_coeff1, pool);
+    evaluator.rescale_to_next_inplace(workspace.x_coeff1, pool);
+    workspace.x_coeff1.scale() = scale;
+    evaluator.mod_switch_to_inplace(workspace.x_coeff1, last_parms_id, pool);
+
+    // sigmoid = 0.5 + 0.25x - 0.021x^3 + 0.002x^5
+    evaluator.add_plain(workspace.x_coeff1, workspace.plain_coeff0, workspace.sigmoid);
+    evaluator.sub_inplace(workspace.sigmoid, workspace.x_pow_3);
+    evaluator.add_inplace(workspace.sigmoid, workspace.x_pow_5);
+}
+
+// Same as PartialDerivative, reading workspace.sigmoid and writing workspace.partial_derivative
+void PartialDerivative(RelinKeys &relin_keys, const Ciphertext &x_encrypted, const Ciphertext &y_encrypted, double scale, GradientWorkspace &workspace)
+{
+    Evaluator &evaluator = workspace.evaluator;
+    MemoryPoolHandle &pool = workspace.pool;
+
+    parms_id_type result_parms_id = workspace.sigmoid.parms_id();
+    evaluator.mod_switch_to(x_encrypted, result_parms_id, workspace.x, pool);
+    evaluator.mod_switch_to(y_encrypted, result_parms_id, workspace.y, pool);
+    workspace.x.scale() = scale;
+    workspace.y.scale() = scale;
+    workspace.sigmoid.scale() = scale;
+
+    // (y_encrypted - sigmoided_value) * x_encrypted -> Level 1
+    evaluator.negate(workspace.sigmoid, workspace.partial_derivative);
+    evaluator.add_inplace(workspace.partial_derivative, workspace.y);
+    evaluator.multiply_inplace(workspace.partial_derivative, workspace.x, pool);
+    evaluator.relinearize_inplace(workspace.partial_derivative, relin_keys, pool);
+    evaluator.rescale_to_next_inplace(workspace.partial_derivative, pool);
+    workspace.partial_derivative.scale() = scale;
+}
+
+// Compute the partial derivatives of the samples whose mask entry is 1 and return their sum.
+// Each sample is its own ciphertext, so masking a ciphertext with 0 is the same as leaving it out:
+// masked samples are skipped and the mask costs no level.
+// The partial derivatives are accumulated in place in the workspace buffers.
+// Ciphertext output:
+// encrypted_derivatives_sum -> Level 1
+Ciphertext GradientSum(SEALContext &context, RelinKeys &relin_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                       const vector<Ciphertext> &samples, const vector<Ciphertext> &labels, const vector<double> &mask,
+                       GradientWorkspace &workspace)
+{
+    bool first = true;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        if (mask[i] == 0)
+        {
+            continue;
+        }
+
+        // encrypted_products[i] -> Level 5
+        PrepareSigmoidCoefficients(context, workspace, scale, encrypted_products[i].parms_id());
+        Sigmoid(relin_keys, scale, encrypted_products[i], workspace);
+        // workspace.sigmoid -> Level 2
+
+        PartialDerivative(relin_keys, samples[i], labels[i], scale, workspace);
+        // workspace.partial_derivative -> Level 1
+
+        if (first)
+        {
+            workspace.derivatives_sum = workspace.partial_derivative;
+            first = false;
+        }
+        else
+        {
+            workspace.evaluator.add_inplace(workspace.derivatives_sum, workspace.partial_derivative);
+        }
+    }
+    workspace.derivatives_sum.scale() = scale;
+
+    return workspace.derivatives_sum;
+}
+
+Ciphertext GradientSum(SEALContext &context, RelinKeys &relin_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                       const vector<Ciphertext> &samples, const vector<Ciphertext> &labels, const vector<double> &mask)
+{
+    GradientWorkspace workspace(context);
+    return GradientSum(context, relin_keys, scale, encrypted_products, samples, labels, mask, workspace);
+}
+
+// Same as GradientSum, with the selected samples split into thread_count contiguous ranges
+// whose partial sums are computed concurrently and then added.
+Ciphertext GradientSumParallel(SEALContext &context, RelinKeys &relin_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                               const vector<Ciphertext> &samples, const vector<Ciphertext> &labels, const vector<double> &mask, size_t thread_count)
+{
+    size_t range_size = (samples.size() + thread_count - 1) / thread_count;
+    vector<Ciphertext> partial_sums(thread_count);
+    vector<bool> has_samples(thread_count, false);
+    vector<thread> workers;
+    for (size_t t = 0; t < thread_count; ++t)
+    {
+        vector<double> range_mask(samples.size(), 0);
+        for (size_t i = t * range_size; i < min(samples.size(), (t + 1) * range_size); ++i)
+        {
+            range_mask[i] = mask[i];
+            has_samples[t] = has_samples[t] || mask[i] != 0;
+        }
+        if (!has_samples[t])
+        {
+            continue;
+        }
+        workers.emplace_back([&, t, range_mask]()
+                             { partial_sums[t] = GradientSum(context, relin_keys, scale, encrypted_products, samples, labels, range_mask); });
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+    }
+
+    vector<Ciphertext> derivatives;
+    for (size_t t = 0; t < thread_count; ++t)
+    {
+        if (has_samples[t])
+        {
+            derivatives.push_back(partial_sums[t]);
+        }
+    }
+    Ciphertext encrypted_derivatives_sum = SumPartialDerivative(context, relin_keys, derivatives);
+    encrypted_derivatives_sum.scale() = scale;
+    return encrypted_derivatives_sum;
+}
+
+// Label-packed samples: one ciphertext per sample, holding the sample x in slots [0, offset)
+// and y * x in slots [offset, 2 * offset) (see PackSampleWithLabel).
+// Since (y - sigmoid) * x = y * x - sigmoid * x and the sum of y * x does not depend on the weights,
+// the label part is extracted once by LabelTerm, and every iteration only multiplies the sigmoid by
+// the packed sample: one ciphertext to encrypt and one mod-switch per sample instead of two.
+// Slots past offset of the resulting gradient hold -sum sigmoid * y * x and are dropped with the weights padding.
+
+// Sum of y * x over the samples selected by mask, moved to slots [0, offset) and cleared elsewhere
+// Ciphertext inputs:
+// packed_samples   -> Level 2 (SampleParmsId)
+// Ciphertext output:
+// label_term       -> Level 1
+Ciphertext LabelTerm(SEALContext &context, GaloisKeys &galois_keys, double scale, const vector<Ciphertext> &packed_samples,
+                     const vector<double> &mask, size_t offset)
+{
+    Evaluator evaluator(context);
+    CKKSEncoder encoder(context);
+
+    Ciphertext label_term;
+    bool first = true;
+    for (size_t i = 0; i < packed_samples.size(); ++i)
+    {
+        if (mask[i] == 0)
+        {
+            continue;
+        }
+        if (first)
+        {
+            label_term = packed_samples[i];
+            first = false;
+        }
+        else
+        {
+            evaluator.add_inplace(label_term, packed_samples[i]);
+        }
+    }
+    evaluator.rotate_vector_inplace(label_term, int(offset), galois_keys);
+
+    // The rotation also brings the sum of x to the last slots: keep slots [0, offset) only
+    Plaintext plain_mask;
+    encoder.encode(vector<double>(offset, 1), label_term.parms_id(), scale, plain_mask);
+    evaluator.multiply_plain_inplace(label_term, plain_mask);
+    evaluator.rescale_to_next_inplace(label_term);
+    label_term.scale() = scale;
+
+    return label_term;
+}
+
+// sigmoid * packed_sample, reading workspace.sigmoid and writing workspace.partial_derivative
+void SigmoidProduct(RelinKeys &relin_keys, const Ciphertext &packed_sample, double scale, GradientWorkspace &workspace)
+{
+    Evaluator &evaluator = workspace.evaluator;
+    MemoryPoolHandle &pool = workspace.pool;
+
+    evaluator.mod_switch_to(packed_sample, workspace.sigmoid.parms_id(), workspace.x, pool);
+    workspace.x.scale() = scale;
+    workspace.sigmoid.scale() = scale;
+
+    // sigmoided_value * packed_sample -> Level 1
+    evaluator.multiply(workspace.sigmoid, workspace.x, workspace.partial_derivative, pool);
+    evaluator.relinearize_inplace(workspace.partial_derivative, relin_keys, pool);
+    evaluator.rescale_to_next_inplace(workspace.partial_derivative, pool);
+    workspace.partial_derivative.scale() = scale;
+}
+
+// Sum of sigmoid * packed_sample over the samples selected by mask, accumulated in workspace.derivatives_sum
+// Ciphertext output:
+// sigmoid_product_sum -> Level 1
+Ciphertext SigmoidProductSum(SEALContext &context, RelinKeys &relin_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                             const vector<Ciphertext> &packed_samples, const vector<double> &mask, GradientWorkspace &workspace)
+{
+    bool first = true;
+    for (size_t i = 0; i < packed_samples.size(); ++i)
+    {
+        if (mask[i] == 0)
+        {
+            continue;
+        }
+
+        PrepareSigmoidCoefficients(context, workspace, scale, encrypted_products[i].parms_id());
+        Sigmoid(relin_keys, scale, encrypted_products[i], workspace);
+        // workspace.sigmoid -> Level 2
+
+        SigmoidProduct(relin_keys, packed_samples[i], scale, workspace);
+        // workspace.partial_derivative -> Level 1
+
+        if (first)
+        {
+            workspace.derivatives_sum = workspace.partial_derivative;
+            first = false;
+        }
+        else
+        {
+            workspace.evaluator.add_inplace(workspace.derivatives_sum, workspace.partial_derivative);
+        }
+    }
+    workspace.derivatives_sum.scale() = scale;
+
+    return workspace.derivatives_sum;
+}
+
+// label_term - sigmoid_product_sum
+// Ciphertext inputs:
+// label_term           -> Level 1
+// sigmoid_product_sum  -> Level 1
+// Ciphertext output:
+// encrypted_derivatives_sum -> Level 1
+Ciphertext SubtractFromLabelTerm(SEALContext &context, double scale, const Ciphertext &label_term, const Ciphertext &sigmoid_product_sum)
+{
+    Evaluator evaluator(context);
+
+    Ciphertext encrypted_label_term;
+    evaluator.mod_switch_to(label_term, sigmoid_product_sum.parms_id(), encrypted_label_term);
+    encrypted_label_term.scale() = scale;
+
+    Ciphertext encrypted_derivatives_sum = sigmoid_product_sum;
+    encrypted_derivatives_sum.scale() = scale;
+    evaluator.negate_inplace(encrypted_derivatives_sum);
+    evaluator.add_inplace(encrypted_derivatives_sum, encrypted_label_term);
+    return encrypted_derivatives_sum;
+}
+
+// Same as GradientSum on label-packed samples: label_term - sum of sigmoid * packed_sample over the selected samples
+// Ciphertext inputs:
+// packed_samples   -> Level 2 (SampleParmsId)
+// label_term       -> Level 1
+// Ciphertext output:
+// encrypted_derivatives_sum -> Level 1
+Ciphertext GradientSum(SEALContext &context, RelinKeys &relin_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                       const vector<Ciphertext> &packed_samples, const Ciphertext &label_term, const vector<double> &mask,
+                       GradientWorkspace &workspace)
+{
+    SigmoidProductSum(context, relin_keys, scale, encrypted_products, packed_samples, mask, workspace);
+
+    // derivatives_sum = label_term - derivatives_sum
+    workspace.evaluator.mod_switch_to(label_term, workspace.derivatives_sum.parms_id(), workspace.y, workspace.pool);
+    workspace.y.scale() = scale;
+    workspace.evaluator.negate_inplace(workspace.derivatives_sum);
+    workspace.evaluator.add_inplace(workspace.derivatives_sum, workspace.y);
+
+    return workspace.derivatives_sum;
+}
+
+// Apply one gradient step: weight + learning_rate / m * derivatives_sum, where m is the number of summed samples.
+// Ciphertext inputs:
+// encrypted_derivatives_sum    -> Level 1
+// weight                       -> Level 5, or any level down to 0
+// learning_rate                -> Level 5, or any level down to 2
+// Ciphertext output:
+// trained_weight               -> Level 0
+Ciphertext UpdateWeight(SEALContext &context, RelinKeys &relin_keys, double scale, const Ciphertext &encrypted_derivatives_sum,
+                        size_t sample_count, const Ciphertext &weight, const Ciphertext &learning_rate)
 {
     Evaluator evaluator(context);
 
     // --------------------------------------------------------------------- //
     // Compute (learning_rate / m)
+    // 1 / m is encoded at the level of learning_rate, which may be below the top level
+    CKKSEncoder encoder(context);
     Plaintext plain_m;
-    Encode(context, 1.0 / samples.size(), scale, plain_m);
+    Encode(encoder, 1.0 / sample_count, learning_rate.parms_id(), scale, plain_m);
 
     Ciphertext learning_rate_mul_inv_m;
     evaluator.multiply_plain(learning_rate, plain_m, learning_rate_mul_inv_m);
@@ -333,37 +837,6 @@ Ciphertext Train(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois
     learning_rate_mul_inv_m.scale() = scale;
     // learning_rate_mul_inv_m -> Level 4
 
-    // --------------------------------------------------------------------- //
-    // Privacy preserving logistic regression algorithm
-    vector<Ciphertext> partial_derivatives;
-    // Compute sigmoid values of all samples
-    for (size_t i = 0; i < samples.size(); ++i)
-    {
-        // ----------------------------------------------------------------- //
-        Ciphertext encrypted_sample_x_weights = encrypted_products[i];
-        // encrypted_sample_x_weights -> Level 5
-
-        // ----------------------------------------------------------------- //
-        // Perform sigmoid function
-        Ciphertext sigmoid = Sigmoid(context, relin_keys, scale, encrypted_sample_x_weights);
-        sigmoid.scale() = scale;
-        // sigmoid -> Level 2
-
-        // ----------------------------------------------------------------- //
-        // Compute the partial derivative of the weighted sample
-        Ciphertext partial_derivative = PartialDerivative(context, relin_keys, sigmoid, samples[i], labels[i], scale);
-        partial_derivative.scale() = scale;
-        // partial_derivative -> Level 1
-
-        partial_derivatives.push_back(partial_derivative);
-    }
-
-    // --------------------------------------------------------------------- //
-    // Compute the sum of the partial derivatives
-    Ciphertext encrypted_derivatives_sum = SumPartialDerivative(context, relin_keys, partial_derivatives);
-    encrypted_derivatives_sum.scale() = scale;
-    // encrypted_derivatives_sum -> Level 1
-
     // --------------------------------------------------------------------- //
     // Modulus switch learning_rate_mul_inv_m to level 1
     parms_id_type encrypted_derivatives_sum_parms_id = encrypted_derivatives_sum.parms_id();
@@ -395,3 +868,79 @@ Ciphertext Train(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois
 
     return trained_weight;
 }
+
+// Train on the samples selected by mask only (1 = train on the sample, 0 = leave it out).
+// This algorithm is only able to train 1 iteration at a time due to incompatible levels of operands at the end of the algorithm.
+// This function return the new adjusted encrypted weights parameter.
+Ciphertext Train(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                 const vector<Ciphertext> &samples, const vector<Ciphertext> &labels,
+                 const Ciphertext &weight, const Ciphertext &learning_rate, size_t slot_count, const vector<double> &mask,
+                 GradientWorkspace &workspace)
+{
+    size_t sample_count = 0;
+    for (size_t i = 0; i < mask.size(); ++i)
+    {
+        if (mask[i] != 0)
+        {
+            ++sample_count;
+        }
+    }
+
+    Ciphertext encrypted_derivatives_sum = GradientSum(context, relin_keys, scale, encrypted_products, samples, labels, mask, workspace);
+    return UpdateWeight(context, relin_keys, scale, encrypted_derivatives_sum, sample_count, weight, learning_rate);
+}
+
+// This algorithm is only able to train 1 iteration at a time due to incompatible levels of operands at the end of the algorithm.
+// This function return the new adjusted encrypted weights parameter.
+Ciphertext Train(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                 const vector<Ciphertext> &samples, const vector<Ciphertext> &labels,
+                 const Ciphertext &weight, const Ciphertext &learning_rate, size_t slot_count)
+{
+    vector<double> mask(samples.size(), 1);
+    GradientWorkspace workspace(context);
+    return Train(context, relin_keys, galois_keys, scale, encrypted_products, samples, labels, weight, learning_rate, slot_count, mask, workspace);
+}
+
+Ciphertext Train(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                 const vector<Ciphertext> &samples, const vector<Ciphertext> &labels,
+                 const Ciphertext &weight, const Ciphertext &learning_rate, size_t slot_count, const vector<double> &mask)
+{
+    GradientWorkspace workspace(context);
+    return Train(context, relin_keys, galois_keys, scale, encrypted_products, samples, labels, weight, learning_rate, slot_count, mask, workspace);
+}
+
+// Same as the overload above, reusing the buffers of workspace across iterations
+Ciphertext Train(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                 const vector<Ciphertext> &samples, const vector<Ciphertext> &labels,
+                 const Ciphertext &weight, const Ciphertext &learning_rate, size_t slot_count, GradientWorkspace &workspace)
+{
+    vector<double> mask(samples.size(), 1);
+    return Train(context, relin_keys, galois_keys, scale, encrypted_products, samples, labels, weight, learning_rate, slot_count, mask, workspace);
+}
+
+// Train on label-packed samples; label_term must have been computed with the same mask
+Ciphertext Train(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                 const vector<Ciphertext> &packed_samples, const Ciphertext &label_term,
+                 const Ciphertext &weight, const Ciphertext &learning_rate, size_t slot_count, const vector<double> &mask,
+                 GradientWorkspace &workspace)
+{
+    size_t sample_count = 0;
+    for (size_t i = 0; i < mask.size(); ++i)
+    {
+        if (mask[i] != 0)
+        {
+            ++sample_count;
+        }
+    }
+
+    Ciphertext encrypted_derivatives_sum = GradientSum(context, relin_keys, scale, encrypted_products, packed_samples, label_term, mask, workspace);
+    return UpdateWeight(context, relin_keys, scale, encrypted_derivatives_sum, sample_count, weight, learning_rate);
+}
+
+Ciphertext Train(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale, const vector<Ciphertext> &encrypted_products,
+                 const vector<Ciphertext> &packed_samples, const Ciphertext &label_term,
+                 const Ciphertext &weight, const Ciphertext &learning_rate, size_t slot_count, GradientWorkspace &workspace)
+{
+    vector<double> mask(packed_samples.size(), 1);
+    return Train(context, relin_keys, galois_keys, scale, encrypted_products, packed_samples, label_term, weight, learning_rate, slot_count, mask, workspace);
+}
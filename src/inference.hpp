@@ -0,0 +1,102 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <map>
+#include <chrono>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "plain_algorithms.hpp"
+using namespace std;
+using namespace seal;
+
+// Scoring of encrypted records with a plaintext model, for when the model owner runs inference.
+// A CKKS plaintext encoded at a parms_id is already in NTT form for that level, so the weights are encoded
+// once per level and kept; every record then costs one multiply_plain and no relinearization,
+// where encrypted weights cost a ciphertext multiply and a relinearization.
+
+struct PreparedModel
+{
+    vector<double> weights;
+    // weights encoded at every level they have been applied at
+    map<parms_id_type, Plaintext> plain_weights;
+};
+
+PreparedModel PrepareModel(const vector<double> &weights)
+{
+    PreparedModel model;
+    model.weights = weights;
+    return model;
+}
+
+// The weights encoded for records at parms_id, encoding them on first use only.
+// Not thread-safe: share a PreparedModel between threads only after every level in use has been prepared.
+const Plaintext &PreparedWeights(CKKSEncoder &encoder, PreparedModel &model, parms_id_type parms_id, double scale)
+{
+    auto cached = model.plain_weights.find(parms_id);
+    if (cached != model.plain_weights.end())
+    {
+        return cached->second;
+    }
+    Plaintext &plain_weights = model.plain_weights[parms_id];
+    encoder.encode(model.weights, parms_id, scale, plain_weights);
+    return plain_weights;
+}
+
+// sigmoid(record . weights) in slot 0, with plaintext weights
+// Ciphertext inputs:
+// record   -> Level 5
+// Ciphertext output:
+// score    -> Level 1
+// galois_keys must hold the steps of RowRotationSteps(model.weights.size()).
+Ciphertext ScoreRecord(SEALContext &context, CKKSEncoder &encoder, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale,
+                       const Ciphertext &record, PreparedModel &model)
+{
+    Evaluator evaluator(context);
+
+    Ciphertext encrypted_product;
+    evaluator.multiply_plain(record, PreparedWeights(encoder, model, record.parms_id(), scale), encrypted_product);
+    evaluator.rescale_to_next_inplace(encrypted_product);
+    encrypted_product.scale() = scale;
+    // encrypted_product -> Level 4
+
+    Ciphertext encrypted_inner_product = Sum(context, galois_keys, encrypted_product, model.weights.size());
+    return Sigmoid(context, relin_keys, scale, encrypted_inner_product);
+}
+
+// Same as ScoreRecord with encrypted weights
+Ciphertext ScoreRecord(SEALContext &context, RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale,
+                       const Ciphertext &record, const Ciphertext &encrypted_weights, size_t width)
+{
+    Ciphertext encrypted_inner_product = VectorMultiplication(context, relin_keys, galois_keys, record, encrypted_weights, width);
+    encrypted_inner_product.scale() = scale;
+    return Sigmoid(context, relin_keys, scale, encrypted_inner_product);
+}
+
+// Score every record with the prepared model, decrypt the scores and report accuracy and latency
+vector<double> ScoreRecords(SEALContext &context, CKKSEncoder &encoder, SecretKey &secret_key, RelinKeys &relin_keys, GaloisKeys &galois_keys,
+                            double scale, const vector<Ciphertext> &records, const vector<double> &labels, PreparedModel &model)
+{
+    vector<double> scores(records.size());
+    size_t correct = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        Ciphertext encrypted_score = ScoreRecord(context, encoder, relin_keys, galois_keys, scale, records[i], model);
+        Plaintext plain_score = Decrypt(context, secret_key, encrypted_score);
+        vector<double> score;
+        Decode(encoder, plain_score, score);
+        scores[i] = score[0];
+        if (round(scores[i]) == labels[i])
+        {
+            ++correct;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Scored " << records.size() << " records\t\t"
+         << "Latency: " << seconds / records.size() * 1000 << " ms/record\t\t"
+         << "Throughput: " << records.size() / seconds << " records/s\t\t"
+         << "Accuracy: " << double(correct) / records.size() << endl;
+    return scores;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <filesystem>
+#include <stdexcept>
+
+#include "seal/seal.h"
+#include "checkpoint.hpp"
+#include "normalization.hpp"
+using namespace std;
+using namespace seal;
+
+// Key store: the public, relinearization and Galois keys serialized once into one file,
+//     magic, parms_id of the keys, fingerprint of the secret key, size of every key section, the key sections
+// The sections are uncompressed, so a process maps the file read-only and loads a key with one validated copy
+// out of the mapping instead of regenerating it or reading it through a stream.
+// SEAL key objects always own their data, so the mapped pages themselves are not used as keys; processes forked
+// after the keys are loaded share the one copy, copy-on-write, since evaluation only reads them.
+// The workers of distributed mode map their relinearization keys from the store instead of receiving them.
+
+const char KEY_STORE_MAGIC[8] = {'H', 'E', 'L', 'R', 'K', 'E', 'Y', 'S'};
+const size_t KEY_STORE_SECTIONS = 3;
+
+// Read-only view of a key store file
+struct KeyStore
+{
+    MappedFile file;
+    parms_id_type parms_id;
+    uint64_t key_fingerprint;
+    // public key, relinearization keys, Galois keys
+    uint64_t section_offset[KEY_STORE_SECTIONS];
+    uint64_t section_size[KEY_STORE_SECTIONS];
+
+    // Throw if the file is not a key store or was written with other encryption parameters
+    KeyStore(string filename, SEALContext &context) : file(filename)
+    {
+        size_t header_bytes = sizeof(KEY_STORE_MAGIC) + sizeof(parms_id) + sizeof(key_fingerprint) + sizeof(section_size);
+        if (file.size < header_bytes || !equal(KEY_STORE_MAGIC, KEY_STORE_MAGIC + sizeof(KEY_STORE_MAGIC), file.data))
+        {
+            throw runtime_error(filename + " is not a key store");
+        }
+        const char *p = file.data + sizeof(KEY_STORE_MAGIC);
+        copy(p, p + sizeof(parms_id), reinterpret_cast<char *>(&parms_id));
+        p += sizeof(parms_id);
+        copy(p, p + sizeof(key_fingerprint), reinterpret_cast<char *>(&key_fingerprint));
+        p += sizeof(key_fingerprint);
+        copy(p, p + sizeof(section_size), reinterpret_cast<char *>(section_size));
+
+        uint64_t offset = header_bytes;
+        for (size_t s = 0; s < KEY_STORE_SECTIONS; ++s)
+        {
+            section_offset[s] = offset;
+            offset += section_size[s];
+        }
+        if (offset != file.size)
+        {
+            throw runtime_error(filename + " is truncated");
+        }
+        if (parms_id != context.key_parms_id())
+        {
+            throw runtime_error(filename + " was written with different encryption parameters");
+        }
+    }
+};
+
+void WriteKeyStore(string filename, SEALContext &context, const SecretKey &secret_key, const PublicKey &public_key,
+                   const RelinKeys &relin_keys, const GaloisKeys &galois_keys)
+{
+    stringstream sections[KEY_STORE_SECTIONS];
+    public_key.save(sections[0], compr_mode_type::none);
+    relin_keys.save(sections[1], compr_mode_type::none);
+    galois_keys.save(sections[2], compr_mode_type::none);
+
+    WriteFileAtomically(filename, [&](ostream &out)
+                        {
+                            out.write(KEY_STORE_MAGIC, sizeof(KEY_STORE_MAGIC));
+                            WriteValue(out, context.key_parms_id());
+                            WriteValue(out, KeyFingerprint(secret_key));
+                            for (size_t s = 0; s < KEY_STORE_SECTIONS; ++s)
+                            {
+                                WriteValue(out, uint64_t(sections[s].tellp()));
+                            }
+                            for (size_t s = 0; s < KEY_STORE_SECTIONS; ++s)
+                            {
+                                out << sections[s].rdbuf();
+                            } });
+}
+
+template <typename Key>
+void LoadKeySection(SEALContext &context, const KeyStore &store, size_t section, Key &key)
+{
+    key.load(context, reinterpret_cast<const seal_byte *>(store.file.data + store.section_offset[section]), store.section_size[section]);
+}
+
+void LoadFromKeyStore(SEALContext &context, const KeyStore &store, PublicKey &public_key)
+{
+    LoadKeySection(context, store, 0, public_key);
+}
+
+void LoadFromKeyStore(SEALContext &context, const KeyStore &store, RelinKeys &relin_keys)
+{
+    LoadKeySection(context, store, 1, relin_keys);
+}
+
+void LoadFromKeyStore(SEALContext &context, const KeyStore &store, GaloisKeys &galois_keys)
+{
+    LoadKeySection(context, store, 2, galois_keys);
+}
+
+// Load the evaluation keys of secret_key from the key store, generating and storing them first
+// if there is no store or it belongs to another secret key.
+// A store only pays off when the secret key outlives the run, so an empty filename generates the keys in memory only.
+void LoadOrCreateKeys(string filename, SEALContext &context, SecretKey &secret_key, PublicKey &public_key, RelinKeys &relin_keys,
+                      GaloisKeys &galois_keys)
+{
+    if (!filename.empty() && filesystem::exists(filename))
+    {
+        KeyStore store(filename, context);
+        if (store.key_fingerprint == KeyFingerprint(secret_key))
+        {
+            LoadFromKeyStore(context, store, public_key);
+            LoadFromKeyStore(context, store, relin_keys);
+            LoadFromKeyStore(context, store, galois_keys);
+            return;
+        }
+    }
+
+    KeyGenerator keygen(context, secret_key);
+    keygen.create_public_key(public_key);
+    keygen.create_relin_keys(relin_keys);
+    keygen.create_galois_keys(galois_keys);
+    if (!filename.empty())
+    {
+        WriteKeyStore(filename, context, secret_key, public_key, relin_keys, galois_keys);
+    }
+}
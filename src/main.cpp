@@ -1,45 +1,78 @@
 #include <iostream>
 #include <vector>
 #include <random>
+#include <sstream>
+#include <cstdlib>
 
 #include "seal/seal.h"
 #include "homomorphic.hpp"
 #include "data_preprocessing.hpp"
+#include "normalization.hpp"
 #include "plain_algorithms.hpp"
+#include "sweep.hpp"
+#include "cross_validation.hpp"
+#include "streaming.hpp"
+#include "column_packing.hpp"
+#include "cpu_features.hpp"
+#include "distributed.hpp"
+#include "checkpoint.hpp"
+#include "cost_model.hpp"
+#include "multiclass.hpp"
+#include "scheduler.hpp"
+#include "inference.hpp"
+#include "online.hpp"
+#include "keystore.hpp"
 using namespace std;
 using namespace seal;
 
 #define MAX_ITER 10
 
-int main()
+int main(int argc, char *argv[])
 {
-    srand(time(0));
+    // train: train one model with the learning rate below
+    // sweep [rate ...]: train one model per learning rate in the same ciphertexts
+    // cv [k]: k-fold cross-validation, one thread per fold
+    // stream [block size]: stream the encrypted dataset from disk instead of keeping it in memory
+    // columns [sparse]: one ciphertext per feature column instead of one per sample; sparse leaves out all-zero blocks
+    // distributed [max workers]: train with 1 to max workers processes and report the scaling efficiency
+    // multiclass [csv file]: one-vs-rest models for every class of the last column, trained in the same ciphertexts
+    // jobs [workers] [rate ...]: train one model per learning rate as concurrent jobs on a shared pool of workers
+    // score [weights csv]: score the encrypted dataset with plaintext weights, as the model owner would
+    // plan [samples] [features] [max threads] [coeff modulus bits ...]: predict the cost of every layout without encrypting anything
+    // online [csv file] [block size] [replay]: append the new rows of the csv to the encrypted sample log and
+    //     take one gradient step per block of new records, each mixed with replay records drawn from the history
+    string mode = argc > 1 ? argv[1] : "train";
+    // worker <socket>: a worker process of distributed mode; it is exec-ed by the coordinator and never reads the secret key
+    if (mode == "worker" && argc > 2)
+    {
+        try
+        {
+            RunWorker(argv[2]);
+        }
+        catch (exception &e)
+        {
+            cerr << "Worker: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    unsigned int seed = time(0);
     /*
     [DATA PREPROCESSING]
     */
-    // Read data from csv file
-    auto train_features = ReadDatasetFromCSV(".\\dataset\\diabetes_normalized.csv");
-    if (train_features.back().size() == 0)
-    {
-        train_features.pop_back();
-    }
-
-    auto labels = ExtractLabel(train_features, 9);
+    // Read the raw csv file and scale every row to unit L2 norm on the fly, as diabetes_normalized.csv was; no normalized copy is written
+    vector<vector<double>> train_features;
+    vector<double> labels;
+    ReadScaledDataset("dataset/diabetes.csv", "l2", thread::hardware_concurrency(), train_features, labels);
     double learning_rate = 0.01;
 
-    int iteration = ReadCheckpointFromFile(".\\weights\\iteration.txt");
-    vector<double> weights(train_features[0].size(), rand());
-    if (iteration > 1)
-    {
-        weights = ReadWeightsFromCSV(".\\weights\\weights.csv");
-    }
-
     /*
     [HOMOMORPHIC INITIALIZATION]
     */
     // Initialize a SEALContext object
     SEALContext context = SetupCKKS();
     print_parameters(context);
+    PrintKernelReport(context);
     // Validate parameters
     cout << "Are the parameters valid? " << context.parameter_error_message() << endl;
     cout << endl;
@@ -48,76 +81,296 @@ int main()
     CKKSEncoder encoder(context);
     size_t slot_count = encoder.slot_count();
 
+    if (mode == "plan")
+    {
+        size_t sample_count = argc > 2 ? stoul(argv[2]) : train_features.size();
+        size_t feature_count = argc > 3 ? stoul(argv[3]) : train_features[0].size();
+        size_t max_threads = argc > 4 ? stoul(argv[4]) : thread::hardware_concurrency();
+        // Plan for another coefficient modulus chain than the one above, e.g. "plan 768 8 4 60 40 40 40 40 40 40 60"
+        vector<int> coeff_modulus_bits;
+        for (int i = 5; i < argc; ++i)
+        {
+            coeff_modulus_bits.push_back(stoi(argv[i]));
+        }
+        SEALContext plan_context = coeff_modulus_bits.empty() ? context : SetupCKKS(16384, coeff_modulus_bits);
+        OpTable latencies = LoadOrCalibrateLatencies("weights/latencies", plan_context);
+        for (string layout : {"rows", "packed", "columns"})
+        {
+            for (size_t thread_count = 1; thread_count <= max_threads; thread_count <<= 1)
+            {
+                TrainingConfig config = {layout, sample_count, feature_count, thread_count};
+                PrintEstimate(config, PlanTraining(plan_context, latencies, config));
+                // The other layouts cost the same with any number of threads
+                if (!LayoutRunsInParallel(layout))
+                {
+                    break;
+                }
+            }
+        }
+        return 0;
+    }
+
     // Generate keys
-    KeyGenerator keygen(context);
-    SecretKey secret_key = keygen.secret_key();
+    // Set HELR_SECRET_KEY to a file outside weights/ to keep the secret key, so that an interrupted run can be resumed.
+    // Without it every run gets a new key, and checkpoints and caches of earlier runs are not reused.
+    const char *secret_key_filename = getenv("HELR_SECRET_KEY");
+    SecretKey secret_key = LoadOrCreateSecretKey(secret_key_filename != nullptr ? secret_key_filename : "", context);
+    KeyGenerator keygen(context, secret_key);
+    // With a kept secret key, the evaluation keys are generated once and mapped from the key store by later runs
+    string key_store_filename = "weights/key_store.bin";
     PublicKey public_key;
-    keygen.create_public_key(public_key);
     RelinKeys relin_keys;
-    keygen.create_relin_keys(relin_keys);
     GaloisKeys galois_keys;
-    keygen.create_galois_keys(galois_keys);
+    LoadOrCreateKeys(secret_key_filename != nullptr ? key_store_filename : "", context, secret_key, public_key, relin_keys, galois_keys);
 
-    /*
-    [DATA PREPARATION FOR HOMOMORPHIC TRAINING]
-    */
-    // Encrypt features
-    vector<Ciphertext> encrypted_features;
-    for (int i = 0; i < train_features.size(); ++i)
+    srand(seed);
+    vector<double> weights(train_features[0].size(), rand());
+
+    if (mode == "online")
     {
-        Plaintext plain_feature;
-        Encode(encoder, train_features[i], scale, plain_feature);
-        Ciphertext encrypted_feature = Encrypt(context, public_key, scale, plain_feature);
-        encrypted_features.push_back((encrypted_feature));
+        // The log outlives the run, so it needs the same key every time
+        if (secret_key_filename == nullptr)
+        {
+            cerr << "online mode needs HELR_SECRET_KEY to keep the secret key of the sample log" << endl;
+            return 1;
+        }
+        string csv_filename = argc > 2 ? argv[2] : "dataset/diabetes.csv";
+        size_t block_size = argc > 3 ? stoul(argv[3]) : 64;
+        size_t replay_count = argc > 4 ? stoul(argv[4]) : 0;
+
+        // The log keeps the scaling it was created with, and the rows already in it are not encrypted again.
+        // The whole csv is parsed, since replayed records need their plaintext rows; AppendToSampleLog checks
+        // that the rows the log holds are unchanged.
+        vector<vector<double>> online_features;
+        vector<double> online_labels;
+        SampleLog log;
+        if (OpenSampleLog("weights/sample_log", context, secret_key, log))
+        {
+            ReadScaledDataset(csv_filename, log.scaling, thread::hardware_concurrency(), online_features, online_labels);
+        }
+        else
+        {
+            FeatureScaling scaling = ReadScaledDataset(csv_filename, "l2", thread::hardware_concurrency(), online_features, online_labels);
+            log = CreateSampleLog("weights/sample_log", context, secret_key, scaling);
+        }
+        size_t logged_records = log.record_count;
+        AppendToSampleLog(context, encoder, secret_key, scale, log, online_features, online_labels);
+        cout << "Appended " << log.record_count - logged_records << " records to the sample log (" << log.record_count << " in total)" << endl;
+
+        // Start from the batch-trained weights the first time
+        TrainingCheckpoint online_checkpoint;
+        if (!ReadCheckpoint("weights/online_checkpoint.bin", context, online_checkpoint) ||
+            online_checkpoint.key_fingerprint != KeyFingerprint(secret_key))
+        {
+            weights.resize(online_features[0].size());
+            Plaintext plain_weights;
+            Encode(encoder, weights, context.last_parms_id(), scale, plain_weights);
+            online_checkpoint.parms_id = context.key_parms_id();
+            online_checkpoint.key_fingerprint = KeyFingerprint(secret_key);
+            online_checkpoint.seed = seed;
+            online_checkpoint.iteration = 0;
+            online_checkpoint.learning_rate = learning_rate;
+            online_checkpoint.best_accuracy = 0;
+            online_checkpoint.encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+            online_checkpoint.log_records = 0;
+        }
+
+        TrainOnline(context, encoder, public_key, secret_key, relin_keys, galois_keys, scale, log, online_features, online_labels,
+                    block_size, replay_count, online_checkpoint, "weights/online_checkpoint.bin");
+        Plaintext plain_weights = Decrypt(context, secret_key, online_checkpoint.encrypted_weights);
+        Decode(encoder, plain_weights, weights);
+        weights.resize(online_features[0].size());
+        WriteWeightsToCSV("weights/online_weights.csv", weights);
+        cout << "Train accuracy: " << ComputeAccuracy(online_features, online_labels, weights) << endl;
+        return 0;
     }
 
-    // Encrypt labels
-    vector<Ciphertext> encrypted_labels;
-    for (int i = 0; i < labels.size(); ++i)
+    if (mode == "sweep")
     {
-        Plaintext plain_label;
-        Encode(encoder, labels[i], scale, plain_label);
-        Ciphertext encrypted_label = Encrypt(context, public_key, scale, plain_label);
-        encrypted_labels.push_back(encrypted_label);
+        vector<double> learning_rates = {0.001, 0.003, 0.01, 0.03, 0.1, 0.3};
+        if (argc > 2)
+        {
+            learning_rates.clear();
+            for (int i = 2; i < argc; ++i)
+            {
+                learning_rates.push_back(stod(argv[i]));
+            }
+        }
+        weights = TrainLearningRateSweep(context, encoder, public_key, secret_key, relin_keys, galois_keys, scale,
+                                         train_features, labels, weights, learning_rates, MAX_ITER);
+        WriteWeightsToCSV("weights/best_weights.csv", weights);
+        return 0;
     }
 
+    if (mode == "multiclass")
+    {
+        vector<vector<double>> class_features = train_features;
+        vector<double> class_labels = labels;
+        if (argc > 2)
+        {
+            ReadScaledDataset(argv[2], "minmax", thread::hardware_concurrency(), class_features, class_labels);
+        }
+        vector<double> classes = ClassValues(class_labels);
+        vector<vector<double>> class_weights = TrainOneVsRest(context, encoder, public_key, secret_key, relin_keys, galois_keys, scale,
+                                                              class_features, class_labels, vector<double>(class_features[0].size(), 0),
+                                                              learning_rate, MAX_ITER);
+        for (size_t k = 0; k < classes.size(); ++k)
+        {
+            stringstream filename;
+            filename << "weights/weights_class_" << classes[k] << ".csv";
+            WriteWeightsToCSV(filename.str(), class_weights[k]);
+        }
+        return 0;
+    }
+
+    if (mode == "stream")
+    {
+        size_t block_size = argc > 2 ? stoul(argv[2]) : 64;
+        weights = TrainOutOfCore(context, encoder, public_key, secret_key, relin_keys, scale, train_features, labels, weights,
+                                 learning_rate, block_size, MAX_ITER);
+        WriteWeightsToCSV("weights/weights.csv", weights);
+        return 0;
+    }
+
+    if (mode == "distributed")
+    {
+        size_t max_workers = argc > 2 ? stoul(argv[2]) : 4;
+        // The workers map their keys from the key store, so this run's keys need one too
+        if (secret_key_filename == nullptr)
+        {
+            WriteKeyStore(key_store_filename, context, secret_key, public_key, relin_keys, galois_keys);
+        }
+        weights = TrainDistributedScaling(context, encoder, public_key, secret_key, relin_keys, key_store_filename, scale, train_features,
+                                          labels, weights, learning_rate, max_workers, MAX_ITER);
+        WriteWeightsToCSV("weights/weights.csv", weights);
+        return 0;
+    }
+
+    if (mode == "columns")
+    {
+        bool sparse = argc > 2 && string(argv[2]) == "sparse";
+        weights = TrainColumns(context, encoder, secret_key, relin_keys, galois_keys, scale, train_features, labels, weights,
+                               learning_rate, MAX_ITER, sparse);
+        WriteWeightsToCSV("weights/weights.csv", weights);
+        return 0;
+    }
+
+    /*
+    [DATA PREPARATION FOR HOMOMORPHIC TRAINING]
+    */
+    // The data owner holds the secret key, so samples are encrypted symmetrically
+    // and cached as seeded ciphertexts, which are expanded on load.
+    // Each label is packed into its sample's ciphertext, so there is one ciphertext per sample.
+    // A resumed run reloads the cache instead of encrypting again.
+    vector<Ciphertext> packed_samples;
+    LoadOrEncryptDataset("weights/packed_dataset", context, encoder, secret_key, scale, train_features, labels, packed_samples);
+
     // Encrypt learning rate
+    // Like the samples, the learning rate and the weights are encrypted at the level UpdateWeight uses them at
     Plaintext plain_learning_rate;
-    Encode(encoder, learning_rate, scale, plain_learning_rate);
+    Encode(encoder, learning_rate, SampleParmsId(context), scale, plain_learning_rate);
     Ciphertext encrypted_learning_rate = Encrypt(context, public_key, scale, plain_learning_rate);
 
+    if (mode == "cv")
+    {
+        size_t fold_count = argc > 2 ? stoul(argv[2]) : 5;
+        CrossValidate(context, public_key, secret_key, relin_keys, galois_keys, scale, train_features, labels,
+                      packed_samples, encrypted_learning_rate, weights, fold_count, MAX_ITER);
+        return 0;
+    }
+
+    if (mode == "score")
+    {
+        PreparedModel model = PrepareModel(ReadWeightsFromCSV(argc > 2 ? argv[2] : "weights/best_weights.csv"));
+        model.weights.resize(train_features[0].size());
+        GaloisKeys row_galois_keys = CreateRotationKeys(keygen, RowRotationSteps(model.weights.size()));
+        // Scoring needs the records at the top level, unlike training
+        vector<Ciphertext> records;
+        for (size_t i = 0; i < train_features.size(); ++i)
+        {
+            Plaintext plain_record;
+            Encode(encoder, train_features[i], scale, plain_record);
+            stringstream upload;
+            EncryptSymmetricToStream(context, secret_key, plain_record, upload);
+            records.push_back(LoadCiphertext(context, upload));
+        }
+        ScoreRecords(context, encoder, secret_key, relin_keys, row_galois_keys, scale, records, labels, model);
+        return 0;
+    }
+
+    if (mode == "jobs")
+    {
+        size_t worker_count = argc > 2 ? stoul(argv[2]) : thread::hardware_concurrency();
+        vector<double> learning_rates = {0.001, 0.01, 0.1};
+        if (argc > 3)
+        {
+            learning_rates.clear();
+            for (int i = 3; i < argc; ++i)
+            {
+                learning_rates.push_back(stod(argv[i]));
+            }
+        }
+        TrainConcurrentJobs(context, encoder, public_key, secret_key, relin_keys, galois_keys, scale, train_features, labels,
+                            packed_samples, weights, learning_rates, worker_count, 32, MAX_ITER);
+        return 0;
+    }
+
     /*
     [HOMOMORPHICALLY TRAIN A LOGISTIC REGRESS MODEL]
     */
+    // Resume from the last checkpoint of this key, if any; only this loop writes it, so the other modes never read it
+    TrainingCheckpoint checkpoint;
+    int iteration = 1;
     double best_accuracy = 0;
+    if (ReadCheckpoint("weights/checkpoint.bin", context, checkpoint) && checkpoint.key_fingerprint == KeyFingerprint(secret_key))
+    {
+        seed = checkpoint.seed;
+        Plaintext plain_weights = Decrypt(context, secret_key, checkpoint.encrypted_weights);
+        Decode(context, plain_weights, weights);
+        weights.resize(train_features[0].size());
+        iteration = checkpoint.iteration + 1;
+        learning_rate = checkpoint.learning_rate;
+        best_accuracy = checkpoint.best_accuracy;
+        Encode(encoder, learning_rate, SampleParmsId(context), scale, plain_learning_rate);
+        encrypted_learning_rate = Encrypt(context, public_key, scale, plain_learning_rate);
+        cout << "Resuming after iteration #" << checkpoint.iteration << endl;
+    }
+
+    // Buffers and memory pool of the training hot loop, kept across iterations
+    GradientWorkspace workspace(context);
+    vector<double> all_samples(packed_samples.size(), 1);
+    Ciphertext label_term = LabelTerm(context, galois_keys, scale, packed_samples, all_samples, BlockSize(train_features[0].size()));
     for (iteration; iteration <= MAX_ITER; ++iteration)
     {
         cout << "Iteration #" << iteration << "...\t\t";
         // Encrypt product of features and weights
         vector<Ciphertext> encrypted_products;
+        encrypted_products.reserve(train_features.size());
         for (int i = 0; i < train_features.size(); ++i)
         {
             double product = PlainVectorMultiplication(train_features[i], weights);
             Plaintext plain_product;
             Encode(encoder, product, scale, plain_product);
-            Ciphertext encrypted_product = Encrypt(context, public_key, scale, plain_product);
-            encrypted_products.push_back(encrypted_product);
+            encrypted_products.push_back(Encrypt(context, public_key, scale, plain_product));
         }
 
         // Encrypt weights
         Plaintext plain_weights;
-        Encode(encoder, weights, scale, plain_weights);
+        Encode(encoder, weights, context.last_parms_id(), scale, plain_weights);
         Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
 
         // Start training
         unsigned long iteration_start = clock();
+        size_t allocated_bytes = workspace.pool.alloc_byte_count() + MemoryManager::GetPool().alloc_byte_count();
 
         // Homomorphically train
-        Ciphertext encrypted_trained_weights = Train(context, relin_keys, galois_keys, scale, encrypted_products, encrypted_features, encrypted_labels, encrypted_weights,
-                                                     encrypted_learning_rate, slot_count);
+        Ciphertext encrypted_trained_weights = Train(context, relin_keys, galois_keys, scale, encrypted_products, packed_samples, label_term, encrypted_weights,
+                                                     encrypted_learning_rate, slot_count, workspace);
 
         // End training
         unsigned long iteration_end = clock();
+        // Memory the pools had to request during this iteration; 0 once the hot loop is in a steady state
+        allocated_bytes = workspace.pool.alloc_byte_count() + MemoryManager::GetPool().alloc_byte_count() - allocated_bytes;
 
         // Decrypt and update new weights in place
         Plaintext plain_trained_weights = Decrypt(context, secret_key, encrypted_trained_weights);
@@ -125,19 +378,28 @@ int main()
         weights.resize(train_features[0].size());
 
         cout << "Training time: " << (iteration_end - iteration_start) / CLOCKS_PER_SEC << "s\t\t";
+        cout << "Allocated: " << allocated_bytes / 1024 << " KB\t\t";
         double train_accuracy = ComputeAccuracy(train_features, labels, weights);
         cout << "Train accuracy: " << train_accuracy << endl;
 
         if (train_accuracy > best_accuracy)
         {
             best_accuracy = train_accuracy;
-            WriteWeightsToCSV(".\\weights\\best_weights.csv", weights);
+            WriteWeightsToCSV("weights/best_weights.csv", weights);
         }
 
-        WriteCheckpointToFile(".\\weights\\iteration.txt", iteration);
-        WriteWeightsToCSV(".\\weights\\weights.csv", weights);
+        // Save the encrypted weights so that at most this iteration is lost on a crash
+        checkpoint.parms_id = context.key_parms_id();
+        checkpoint.key_fingerprint = KeyFingerprint(secret_key);
+        checkpoint.seed = seed;
+        checkpoint.iteration = iteration;
+        checkpoint.learning_rate = learning_rate;
+        checkpoint.best_accuracy = best_accuracy;
+        checkpoint.encrypted_weights = encrypted_trained_weights;
+        WriteCheckpoint("weights/checkpoint.bin", checkpoint);
+        WriteWeightsToCSV("weights/weights.csv", weights);
     }
-    weights = ReadWeightsFromCSV(".\\weights\\best_weights.csv");
+    weights = ReadWeightsFromCSV("weights/best_weights.csv");
     cout << "Best weights:" << endl;
     print_vector(weights);
     cout << "Highest accuracy: " << ComputeAccuracy(train_features, labels, weights) << endl;
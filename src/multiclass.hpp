@@ -0,0 +1,91 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <set>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "packing.hpp"
+#include "block_models.hpp"
+#include "plain_algorithms.hpp"
+using namespace std;
+using namespace seal;
+
+// One-vs-rest multi-class training in a single encrypted pass.
+// The binary model of class k owns block k of every ciphertext: the samples are replicated into all blocks,
+// block k of a label holds 1 if the sample is of class k and 0 otherwise, and block k of a product holds
+// sample . weights[k]. Train() is slot-wise, so one Sigmoid / PartialDerivative pass updates every class.
+
+// Distinct label values, in increasing order; class k is classes[k]
+vector<double> ClassValues(const vector<double> &labels)
+{
+    set<double> values(labels.begin(), labels.end());
+    return vector<double>(values.begin(), values.end());
+}
+
+// Predict the class whose model gives the highest sigmoid
+double PredictClass(const vector<double> &sample, const vector<double> &classes, const vector<vector<double>> &weights)
+{
+    size_t best_class = 0;
+    double best_sigmoid = -1;
+    for (size_t k = 0; k < classes.size(); ++k)
+    {
+        double sigmoid = PlainSigmoid(sample, weights[k]);
+        if (sigmoid > best_sigmoid)
+        {
+            best_sigmoid = sigmoid;
+            best_class = k;
+        }
+    }
+    return classes[best_class];
+}
+
+double ComputeMulticlassAccuracy(const vector<vector<double>> &features, const vector<double> &labels, const vector<double> &classes,
+                                 const vector<vector<double>> &weights)
+{
+    size_t correct = 0;
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        if (PredictClass(features[i], classes, weights) == labels[i])
+        {
+            ++correct;
+        }
+    }
+    return double(correct) / features.size();
+}
+
+// Return the weights of every class model, in the order of ClassValues(labels)
+vector<vector<double>> TrainOneVsRest(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key,
+                                      RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale,
+                                      const vector<vector<double>> &features, const vector<double> &labels,
+                                      const vector<double> &initial_weights, double learning_rate, int max_iter)
+{
+    size_t slot_count = encoder.slot_count();
+    size_t width = features[0].size();
+    size_t block_size = BlockSize(width);
+    vector<double> classes = ClassValues(labels);
+    size_t class_count = classes.size();
+    if (block_size * class_count > slot_count)
+    {
+        throw invalid_argument("too many classes to fit in one ciphertext");
+    }
+    cout << class_count << " classes in blocks of " << block_size << " slots" << endl;
+
+    // Block k of a label holds 1 if the sample is of class k and 0 otherwise
+    vector<vector<double>> block_labels;
+    for (size_t i = 0; i < labels.size(); ++i)
+    {
+        vector<double> indicators(class_count);
+        for (size_t k = 0; k < class_count; ++k)
+        {
+            indicators[k] = labels[i] == classes[k] ? 1 : 0;
+        }
+        block_labels.push_back(indicators);
+    }
+
+    vector<vector<double>> weights(class_count, initial_weights);
+    TrainBlockModels(context, encoder, public_key, secret_key, relin_keys, galois_keys, scale, features, block_labels,
+                     vector<double>(class_count, learning_rate), weights, max_iter, [&](const vector<vector<double>> &trained)
+                     { cout << "Train accuracy: " << ComputeMulticlassAccuracy(features, labels, classes, trained) << endl; });
+    return weights;
+}
@@ -0,0 +1,319 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <limits>
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+// Feature scaling straight from the raw csv file, replacing the offline normalized copy.
+// The file is memory-mapped and split into one byte range per thread; every thread parses its rows
+// and accumulates the column statistics of its range in the same pass, and the partial statistics are merged.
+// The scaled rows are only kept in memory, where they are encoded into CKKS slots.
+
+// Read-only memory mapping of a whole file
+struct MappedFile
+{
+    const char *data = nullptr;
+    size_t size = 0;
+
+    MappedFile(string filename)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat file_stat;
+        if (fd < 0 || fstat(fd, &file_stat) != 0)
+        {
+            throw runtime_error("cannot open " + filename);
+        }
+        size = file_stat.st_size;
+        if (size > 0)
+        {
+            void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                close(fd);
+                throw runtime_error("cannot map " + filename);
+            }
+            madvise(mapping, size, MADV_SEQUENTIAL);
+            data = static_cast<const char *>(mapping);
+        }
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (data != nullptr)
+        {
+            munmap(const_cast<char *>(data), size);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+};
+
+struct ColumnStatistics
+{
+    size_t row_count = 0;
+    vector<double> min, max, sum, sum_sq;
+
+    ColumnStatistics(size_t column_count = 0)
+        : min(column_count, numeric_limits<double>::infinity()), max(column_count, -numeric_limits<double>::infinity()),
+          sum(column_count, 0), sum_sq(column_count, 0)
+    {
+    }
+
+    // Accumulate one row; the loop over the columns has no dependency between iterations, so it vectorizes
+    void Add(const double *row)
+    {
+        size_t column_count = sum.size();
+        for (size_t j = 0; j < column_count; ++j)
+        {
+            min[j] = row[j] < min[j] ? row[j] : min[j];
+            max[j] = row[j] > max[j] ? row[j] : max[j];
+            sum[j] += row[j];
+            sum_sq[j] += row[j] * row[j];
+        }
+        ++row_count;
+    }
+
+    void Merge(const ColumnStatistics &other)
+    {
+        for (size_t j = 0; j < sum.size(); ++j)
+        {
+            min[j] = std::min(min[j], other.min[j]);
+            max[j] = std::max(max[j], other.max[j]);
+            sum[j] += other.sum[j];
+            sum_sq[j] += other.sum_sq[j];
+        }
+        row_count += other.row_count;
+    }
+
+    double Mean(size_t j) const
+    {
+        return sum[j] / row_count;
+    }
+
+    double StandardDeviation(size_t j) const
+    {
+        double mean = Mean(j);
+        return sqrt(std::max(0.0, sum_sq[j] / row_count - mean * mean));
+    }
+};
+
+// x' = (x - offset) * factor for every feature column,
+// then with unit_rows every row of features is divided by its L2 norm
+struct FeatureScaling
+{
+    vector<double> offset;
+    vector<double> factor;
+    bool unit_rows = false;
+};
+
+// method is "minmax" (to [0, 1]), "standard" (zero mean, unit variance), or "l2" (every row to unit L2 norm,
+// as in the former diabetes_normalized.csv); constant columns are only shifted
+FeatureScaling ComputeScaling(const ColumnStatistics &statistics, size_t feature_count, string method)
+{
+    FeatureScaling scaling;
+    scaling.unit_rows = method == "l2";
+    for (size_t j = 0; j < feature_count; ++j)
+    {
+        double offset, range;
+        if (method == "l2")
+        {
+            offset = 0;
+            range = 1;
+        }
+        else if (method == "minmax")
+        {
+            offset = statistics.min[j];
+            range = statistics.max[j] - statistics.min[j];
+        }
+        else if (method == "standard")
+        {
+            offset = statistics.Mean(j);
+            range = statistics.StandardDeviation(j);
+        }
+        else
+        {
+            throw invalid_argument("unknown scaling method " + method);
+        }
+        scaling.offset.push_back(offset);
+        scaling.factor.push_back(range > 0 ? 1 / range : 1);
+    }
+    return scaling;
+}
+
+// Parse the comma-separated numbers of the lines in [begin, end) into values, and accumulate their statistics.
+// Blank lines are skipped; lines with a malformed number or another number of columns are skipped and counted in malformed_rows.
+void ParseRange(const char *begin, const char *end, size_t column_count, vector<double> &values, ColumnStatistics &statistics,
+                size_t &malformed_rows)
+{
+    vector<double> row(column_count);
+    const char *p = begin;
+    while (p < end)
+    {
+        const char *line_end = find(p, end, '\n');
+        if (all_of(p, line_end, [](char c)
+                   { return c == ' ' || c == '\r'; }))
+        {
+            p = line_end + 1;
+            continue;
+        }
+        size_t j = 0;
+        bool malformed = false;
+        while (p < line_end && !malformed)
+        {
+            while (p < line_end && (*p == ' ' || *p == '\r'))
+            {
+                ++p;
+            }
+            from_chars_result result = from_chars(p, line_end, j < column_count ? row[j] : row[0]);
+            if (result.ec != errc() || j == column_count)
+            {
+                malformed = true;
+                break;
+            }
+            ++j;
+            p = find(result.ptr, line_end, ',');
+            if (p < line_end)
+            {
+                ++p;
+            }
+        }
+        if (!malformed && j == column_count)
+        {
+            values.insert(values.end(), row.begin(), row.end());
+            statistics.Add(row.data());
+        }
+        else
+        {
+            ++malformed_rows;
+        }
+        p = line_end + 1;
+    }
+}
+
+// Parse a raw csv file with a header row into one row-major array of values per thread,
+// and merge the column statistics of all rows into statistics.
+// Malformed rows are left out and reported on cerr.
+void ParseDataset(string filename, size_t thread_count, size_t &column_count, vector<vector<double>> &values, ColumnStatistics &statistics)
+{
+    MappedFile file(filename);
+    const char *end = file.data + file.size;
+    const char *body = find(file.data, end, '\n');
+    column_count = count(file.data, body, ',') + 1;
+    body = min(body + 1, end);
+
+    // Cut the body into thread_count ranges at line boundaries
+    thread_count = max<size_t>(1, thread_count);
+    vector<const char *> range_begin(thread_count + 1, end);
+    range_begin[0] = body;
+    for (size_t t = 1; t < thread_count; ++t)
+    {
+        const char *cut = body + (end - body) * t / thread_count;
+        cut = max(cut, range_begin[t - 1]);
+        range_begin[t] = min(end, find(cut, end, '\n') + 1);
+    }
+
+    values.assign(thread_count, vector<double>());
+    vector<ColumnStatistics> partial_statistics(thread_count, ColumnStatistics(column_count));
+    vector<size_t> malformed_rows(thread_count, 0);
+    vector<thread> workers;
+    for (size_t t = 0; t < thread_count; ++t)
+    {
+        workers.emplace_back([&, t]()
+                             { ParseRange(range_begin[t], range_begin[t + 1], column_count, values[t], partial_statistics[t], malformed_rows[t]); });
+    }
+    for (size_t t = 0; t < thread_count; ++t)
+    {
+        workers[t].join();
+    }
+    for (size_t t = 1; t < thread_count; ++t)
+    {
+        partial_statistics[0].Merge(partial_statistics[t]);
+        malformed_rows[0] += malformed_rows[t];
+    }
+    statistics = partial_statistics[0];
+    if (malformed_rows[0] > 0)
+    {
+        cerr << "Skipped " << malformed_rows[0] << " malformed rows of " << filename << " (expected " << column_count << " numbers per row)" << endl;
+    }
+    if (statistics.row_count == 0)
+    {
+        throw runtime_error(filename + " has no valid rows");
+    }
+}
+
+// Scale the parsed rows, in file order, and return them with a leading bias column as in ReadDatasetFromCSV
+void ScaleRows(const vector<vector<double>> &values, size_t column_count, const FeatureScaling &scaling,
+               vector<vector<double>> &features, vector<double> &labels)
+{
+    size_t feature_count = column_count - 1;
+    if (scaling.offset.size() != feature_count)
+    {
+        throw invalid_argument("the scaling does not match the number of feature columns");
+    }
+    features.clear();
+    labels.clear();
+    for (size_t t = 0; t < values.size(); ++t)
+    {
+        for (size_t r = 0; r < values[t].size(); r += column_count)
+        {
+            const double *raw_row = values[t].data() + r;
+            vector<double> row(feature_count + 1);
+            row[0] = 1;
+            double norm_sq = 0;
+            for (size_t j = 0; j < feature_count; ++j)
+            {
+                row[j + 1] = (raw_row[j] - scaling.offset[j]) * scaling.factor[j];
+                norm_sq += row[j + 1] * row[j + 1];
+            }
+            if (scaling.unit_rows && norm_sq > 0)
+            {
+                double inverse_norm = 1 / sqrt(norm_sq);
+                for (size_t j = 0; j < feature_count; ++j)
+                {
+                    row[j + 1] *= inverse_norm;
+                }
+            }
+            features.push_back(row);
+            labels.push_back(raw_row[feature_count]);
+        }
+    }
+}
+
+// Read a raw csv file with a header row and the label in the last column, scale its features with method,
+// and return them with a leading bias column as in ReadDatasetFromCSV.
+// Return the scaling, so that rows read later can be scaled the same way.
+FeatureScaling ReadScaledDataset(string filename, string method, size_t thread_count, vector<vector<double>> &features, vector<double> &labels)
+{
+    size_t column_count;
+    vector<vector<double>> values;
+    ColumnStatistics statistics;
+    ParseDataset(filename, thread_count, column_count, values, statistics);
+
+    FeatureScaling scaling = ComputeScaling(statistics, column_count - 1, method);
+    features.reserve(statistics.row_count);
+    labels.reserve(statistics.row_count);
+    ScaleRows(values, column_count, scaling, features, labels);
+    return scaling;
+}
+
+// Same as above with a scaling fixed beforehand
+void ReadScaledDataset(string filename, const FeatureScaling &scaling, size_t thread_count, vector<vector<double>> &features, vector<double> &labels)
+{
+    size_t column_count;
+    vector<vector<double>> values;
+    ColumnStatistics statistics;
+    ParseDataset(filename, thread_count, column_count, values, statistics);
+    ScaleRows(values, column_count, scaling, features, labels);
+}
@@ -0,0 +1,289 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "checkpoint.hpp"
+#include "normalization.hpp"
+#include "packing.hpp"
+#include "plain_algorithms.hpp"
+using namespace std;
+using namespace seal;
+
+// Online training over an append-only log of encrypted samples.
+//     <prefix>.bin: magic, parms_id of the samples, fingerprint of the secret key, feature scaling (see FeatureScaling),
+//                   then one seeded label-packed sample (see PackSampleWithLabel) per record, in arrival order
+//     <prefix>.idx: the end offset and the fingerprint of the plaintext row of every record, 16 bytes each,
+//                   so that any record is one seek away
+// A record is committed once its index entry is written; a record whose append was interrupted is cut off
+// by the next append. The scaling is fixed when the log is created, so that later records are scaled like earlier ones.
+// The data owner still parses the whole csv, since the products of replayed records need their plaintext rows,
+// and the fingerprints make sure those rows are the ones the log encrypted.
+// Every update encrypts and trains on only the records that arrived since the last one, plus an optional replay sample.
+
+const char SAMPLE_LOG_MAGIC[8] = {'H', 'E', 'L', 'R', 'L', 'O', 'G', '3'};
+
+struct SampleLogEntry
+{
+    uint64_t end;
+    uint64_t row_fingerprint;
+};
+
+struct SampleLog
+{
+    string filename;
+    string index_filename;
+    FeatureScaling scaling;
+    uint64_t header_bytes;
+    uint64_t record_count;
+};
+
+// Byte offset where record i begins
+uint64_t RecordBegin(const SampleLog &log, size_t i)
+{
+    if (i == 0)
+    {
+        return log.header_bytes;
+    }
+    fstream index;
+    index.open(log.index_filename, ios::in | ios::binary);
+    index.seekg((i - 1) * sizeof(SampleLogEntry));
+    SampleLogEntry entry;
+    ReadValue(index, entry);
+    if (!index)
+    {
+        throw runtime_error("cannot read " + log.index_filename);
+    }
+    return entry.end;
+}
+
+// Identify the scaled row and label a record was encrypted from
+uint64_t RowFingerprint(const vector<double> &row, double label)
+{
+    string bytes(reinterpret_cast<const char *>(row.data()), row.size() * sizeof(double));
+    bytes.append(reinterpret_cast<const char *>(&label), sizeof(label));
+    return hash<string>{}(bytes);
+}
+
+// Throw unless the first rows of features and labels are the rows the records of the log were encrypted from
+void CheckSampleLog(const SampleLog &log, const vector<vector<double>> &features, const vector<double> &labels)
+{
+    if (features.size() < log.record_count)
+    {
+        throw runtime_error(log.filename + " holds more records than the dataset");
+    }
+    fstream index;
+    index.open(log.index_filename, ios::in | ios::binary);
+    for (size_t i = 0; i < log.record_count; ++i)
+    {
+        SampleLogEntry entry;
+        ReadValue(index, entry);
+        if (!index || entry.row_fingerprint != RowFingerprint(features[i], labels[i]))
+        {
+            throw runtime_error("row " + to_string(i) + " of the dataset is not the row record " + to_string(i) + " of " + log.filename +
+                                " was encrypted from; the dataset must only grow by appending rows");
+        }
+    }
+}
+
+// Create an empty log whose records are scaled with scaling
+SampleLog CreateSampleLog(string prefix, SEALContext &context, SecretKey &secret_key, const FeatureScaling &scaling)
+{
+    SampleLog log = {prefix + ".bin", prefix + ".idx", scaling, 0, 0};
+    uint64_t feature_count = scaling.offset.size();
+    WriteFileAtomically(log.filename, [&](ostream &out)
+                        {
+                            out.write(SAMPLE_LOG_MAGIC, sizeof(SAMPLE_LOG_MAGIC));
+                            WriteValue(out, SampleParmsId(context));
+                            WriteValue(out, KeyFingerprint(secret_key));
+                            WriteValue(out, feature_count);
+                            WriteValue(out, uint8_t(scaling.unit_rows));
+                            out.write(reinterpret_cast<const char *>(scaling.offset.data()), feature_count * sizeof(double));
+                            out.write(reinterpret_cast<const char *>(scaling.factor.data()), feature_count * sizeof(double)); });
+    WriteFileAtomically(log.index_filename, [](ostream &) {});
+    log.header_bytes = filesystem::file_size(log.filename);
+    return log;
+}
+
+// Return false if there is no log at prefix.
+// Throw if the log is unreadable or was written with other encryption parameters or another secret key.
+bool OpenSampleLog(string prefix, SEALContext &context, SecretKey &secret_key, SampleLog &log)
+{
+    log.filename = prefix + ".bin";
+    log.index_filename = prefix + ".idx";
+    if (!filesystem::exists(log.filename) || !filesystem::exists(log.index_filename))
+    {
+        return false;
+    }
+
+    fstream fin;
+    fin.open(log.filename, ios::in | ios::binary);
+    char magic[sizeof(SAMPLE_LOG_MAGIC)];
+    parms_id_type parms_id;
+    uint64_t key_fingerprint, feature_count;
+    uint8_t unit_rows;
+    fin.read(magic, sizeof(magic));
+    ReadValue(fin, parms_id);
+    ReadValue(fin, key_fingerprint);
+    ReadValue(fin, feature_count);
+    ReadValue(fin, unit_rows);
+    if (!fin.good() || !equal(magic, magic + sizeof(magic), SAMPLE_LOG_MAGIC))
+    {
+        throw runtime_error(log.filename + " is not a sample log");
+    }
+    if (parms_id != SampleParmsId(context) || key_fingerprint != KeyFingerprint(secret_key))
+    {
+        throw runtime_error(log.filename + " was written with different encryption parameters or another key");
+    }
+    log.scaling.unit_rows = unit_rows != 0;
+    log.scaling.offset.resize(feature_count);
+    log.scaling.factor.resize(feature_count);
+    fin.read(reinterpret_cast<char *>(log.scaling.offset.data()), feature_count * sizeof(double));
+    fin.read(reinterpret_cast<char *>(log.scaling.factor.data()), feature_count * sizeof(double));
+    log.header_bytes = fin.tellg();
+    fin.close();
+
+    // A partially written index entry belongs to an uncommitted record
+    log.record_count = filesystem::file_size(log.index_filename) / sizeof(SampleLogEntry);
+    return true;
+}
+
+// Encrypt the rows of features past the records already in the log and append them.
+// features must start with the rows the log already holds, in the same order; throw otherwise.
+void AppendToSampleLog(SEALContext &context, CKKSEncoder &encoder, SecretKey &secret_key, double scale, SampleLog &log,
+                       const vector<vector<double>> &features, const vector<double> &labels)
+{
+    CheckSampleLog(log, features, labels);
+
+    // Drop whatever an interrupted append left past the last committed record
+    uint64_t end = RecordBegin(log, log.record_count);
+    filesystem::resize_file(log.filename, end);
+    filesystem::resize_file(log.index_filename, log.record_count * sizeof(SampleLogEntry));
+
+    fstream log_out, index_out;
+    log_out.open(log.filename, ios::out | ios::binary | ios::app);
+    index_out.open(log.index_filename, ios::out | ios::binary | ios::app);
+    for (size_t i = log.record_count; i < features.size(); ++i)
+    {
+        vector<double> packed_sample = PackSampleWithLabel(features[i], labels[i]);
+        Plaintext plain_sample;
+        Encode(encoder, packed_sample, SampleParmsId(context), scale, plain_sample);
+        end += EncryptSymmetricToStream(context, secret_key, plain_sample, log_out);
+        log_out.flush();
+        // The record is committed once its index entry is written
+        WriteValue(index_out, SampleLogEntry{end, RowFingerprint(features[i], labels[i])});
+        index_out.flush();
+        if (log_out.fail() || index_out.fail())
+        {
+            throw runtime_error("cannot append to " + log.filename);
+        }
+        ++log.record_count;
+    }
+}
+
+// Load count consecutive records starting at record first
+vector<Ciphertext> ReadSampleLog(SEALContext &context, const SampleLog &log, size_t first, size_t count)
+{
+    fstream fin;
+    fin.open(log.filename, ios::in | ios::binary);
+    fin.seekg(RecordBegin(log, first));
+    vector<Ciphertext> packed_samples;
+    packed_samples.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        packed_samples.push_back(LoadCiphertext(context, fin));
+    }
+    return packed_samples;
+}
+
+// Take one gradient step per block of up to block_size log records that checkpoint.log_records has not covered yet.
+// Each step trains on the new block plus replay_count records drawn from the records before it.
+// features and labels hold the plaintext rows of the log, which the data owner needs to encrypt the products.
+// The checkpoint is written to checkpoint_filename after every step. Return the number of steps taken.
+int TrainOnline(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key, RelinKeys &relin_keys,
+                GaloisKeys &galois_keys, double scale, const SampleLog &log, const vector<vector<double>> &features,
+                const vector<double> &labels, size_t block_size, size_t replay_count, TrainingCheckpoint &checkpoint,
+                string checkpoint_filename)
+{
+    if (block_size == 0)
+    {
+        throw invalid_argument("block size must be positive");
+    }
+    size_t width = features[0].size();
+    Plaintext plain_weights = Decrypt(context, secret_key, checkpoint.encrypted_weights);
+    vector<double> weights;
+    Decode(encoder, plain_weights, weights);
+    weights.resize(width);
+
+    Plaintext plain_learning_rate;
+    Encode(encoder, checkpoint.learning_rate, SampleParmsId(context), scale, plain_learning_rate);
+    Ciphertext encrypted_learning_rate = Encrypt(context, public_key, scale, plain_learning_rate);
+
+    GradientWorkspace workspace(context);
+    int steps = 0;
+    while (checkpoint.log_records < log.record_count)
+    {
+        size_t first = checkpoint.log_records;
+        size_t count = min<size_t>(block_size, log.record_count - first);
+        vector<size_t> rows;
+        for (size_t i = first; i < first + count; ++i)
+        {
+            rows.push_back(i);
+        }
+        vector<Ciphertext> packed_samples = ReadSampleLog(context, log, first, count);
+        // The replay draws of a block depend on the seed and the block's position in the log only,
+        // so a run resumed at this block draws the same records as an uninterrupted one
+        mt19937 generator(checkpoint.seed + first);
+        for (size_t r = 0; r < replay_count && first > 0; ++r)
+        {
+            size_t row = uniform_int_distribution<size_t>(0, first - 1)(generator);
+            rows.push_back(row);
+            packed_samples.push_back(ReadSampleLog(context, log, row, 1)[0]);
+        }
+
+        // Accuracy on the new block before it is trained on
+        vector<vector<double>> block_features(features.begin() + first, features.begin() + first + count);
+        vector<double> block_labels(labels.begin() + first, labels.begin() + first + count);
+        double block_accuracy = ComputeAccuracy(block_features, block_labels, weights);
+
+        vector<Ciphertext> encrypted_products;
+        encrypted_products.reserve(rows.size());
+        for (size_t row : rows)
+        {
+            Plaintext plain_product;
+            Encode(encoder, PlainVectorMultiplication(features[row], weights), scale, plain_product);
+            encrypted_products.push_back(Encrypt(context, public_key, scale, plain_product));
+        }
+        Encode(encoder, weights, context.last_parms_id(), scale, plain_weights);
+        Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+
+        auto start = chrono::steady_clock::now();
+        vector<double> all_samples(packed_samples.size(), 1);
+        Ciphertext label_term = LabelTerm(context, galois_keys, scale, packed_samples, all_samples, BlockSize(width));
+        Ciphertext encrypted_trained_weights = Train(context, relin_keys, galois_keys, scale, encrypted_products, packed_samples, label_term,
+                                                     encrypted_weights, encrypted_learning_rate, encoder.slot_count(), workspace);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        Plaintext plain_trained_weights = Decrypt(context, secret_key, encrypted_trained_weights);
+        Decode(encoder, plain_trained_weights, weights);
+        weights.resize(width);
+
+        ++checkpoint.iteration;
+        checkpoint.log_records = first + count;
+        checkpoint.encrypted_weights = encrypted_trained_weights;
+        WriteCheckpoint(checkpoint_filename, checkpoint);
+        ++steps;
+
+        cout << "Update #" << checkpoint.iteration << "\t\tRecords: " << first << "-" << first + count - 1 << " + " << rows.size() - count
+             << " replayed\t\tTraining time: " << seconds << "s\t\tAccuracy on the block before the update: " << block_accuracy << endl;
+    }
+    return steps;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <vector>
+using namespace std;
+
+// Several independent models can share one ciphertext by giving each model its own block of slots:
+// model k owns the slots [k * block_size, (k + 1) * block_size).
+// Every homomorphic operation in Train() is slot-wise, so all blocks are trained at once.
+
+// Smallest power of two not less than width
+size_t BlockSize(size_t width)
+{
+    size_t block_size = 1;
+    while (block_size < width)
+    {
+        block_size <<= 1;
+    }
+    return block_size;
+}
+
+// Copy the same row into each of the block_count blocks
+vector<double> ReplicateIntoBlocks(const vector<double> &row, size_t block_size, size_t block_count)
+{
+    vector<double> slots(block_size * block_count, 0);
+    for (size_t k = 0; k < block_count; ++k)
+    {
+        for (size_t i = 0; i < row.size(); ++i)
+        {
+            slots[k * block_size + i] = row[i];
+        }
+    }
+    return slots;
+}
+
+// Fill every slot of block k with values[k]
+vector<double> BroadcastIntoBlocks(const vector<double> &values, size_t block_size)
+{
+    vector<double> slots(block_size * values.size());
+    for (size_t k = 0; k < values.size(); ++k)
+    {
+        for (size_t i = 0; i < block_size; ++i)
+        {
+            slots[k * block_size + i] = values[k];
+        }
+    }
+    return slots;
+}
+
+// Put blocks[k] at the start of block k
+vector<double> PackBlocks(const vector<vector<double>> &blocks, size_t block_size)
+{
+    vector<double> slots(block_size * blocks.size(), 0);
+    for (size_t k = 0; k < blocks.size(); ++k)
+    {
+        for (size_t i = 0; i < blocks[k].size(); ++i)
+        {
+            slots[k * block_size + i] = blocks[k][i];
+        }
+    }
+    return slots;
+}
+
+// Inverse of PackBlocks: the first width slots of each block
+vector<vector<double>> UnpackBlocks(const vector<double> &slots, size_t block_size, size_t block_count, size_t width)
+{
+    vector<vector<double>> blocks(block_count, vector<double>(width));
+    for (size_t k = 0; k < block_count; ++k)
+    {
+        for (size_t i = 0; i < width; ++i)
+        {
+            blocks[k][i] = slots[k * block_size + i];
+        }
+    }
+    return blocks;
+}
+
+// One sample and its label in one row: the sample in slots [0, offset), label * sample in [offset, 2 * offset),
+// with offset = BlockSize(row.size()); see LabelTerm in homomorphic.hpp
+vector<double> PackSampleWithLabel(const vector<double> &row, double label)
+{
+    size_t offset = BlockSize(row.size());
+    vector<double> slots(2 * offset, 0);
+    for (size_t i = 0; i < row.size(); ++i)
+    {
+        slots[i] = row[i];
+        slots[offset + i] = label * row[i];
+    }
+    return slots;
+}
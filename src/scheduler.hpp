@@ -0,0 +1,378 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <algorithm>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "packing.hpp"
+#include "plain_algorithms.hpp"
+using namespace std;
+using namespace seal;
+
+// Work-stealing scheduler for the HE tasks of several concurrent jobs over one SEALContext and key set.
+// A fixed set of workers each own a GradientWorkspace, built on the worker thread so that its memory pool
+// is thread-local, and a task deque. A worker runs its own tasks newest first and, when it has none,
+// steals the oldest task of another worker. Tasks submitted from a worker go to that worker's deque.
+// Jobs only submit tasks and wait for them, so the machine runs worker_count HE threads whatever the number of jobs.
+
+class TaskScheduler
+{
+public:
+    typedef function<void(GradientWorkspace &)> Task;
+
+    // A worker_count of 0 (as from hardware_concurrency() on some systems) runs one worker
+    TaskScheduler(SEALContext &context, size_t worker_count)
+        : context_(context), workers_(max<size_t>(1, worker_count)), start_(chrono::steady_clock::now())
+    {
+        for (size_t w = 0; w < workers_.size(); ++w)
+        {
+            threads_.emplace_back([this, w]()
+                                  { RunWorker(w); });
+        }
+    }
+
+    ~TaskScheduler()
+    {
+        {
+            lock_guard<mutex> lock(sleep_mutex_);
+            stopping_ = true;
+        }
+        work_available_.notify_all();
+        for (size_t w = 0; w < threads_.size(); ++w)
+        {
+            threads_[w].join();
+        }
+    }
+
+    size_t CreateJob(string name)
+    {
+        lock_guard<mutex> lock(job_mutex_);
+        jobs_.emplace_back();
+        jobs_.back().name = name;
+        return jobs_.size() - 1;
+    }
+
+    void Submit(size_t job, Task task)
+    {
+        {
+            lock_guard<mutex> lock(job_mutex_);
+            ++jobs_[job].pending;
+        }
+        // Count the task before it can be popped, so that queued_ never goes below 0
+        {
+            lock_guard<mutex> lock(sleep_mutex_);
+            ++queued_;
+        }
+        size_t w = current_worker_ < workers_.size() ? current_worker_ : next_worker_++ % workers_.size();
+        {
+            lock_guard<mutex> lock(workers_[w].tasks_mutex);
+            workers_[w].tasks.push_back({job, move(task), chrono::steady_clock::now()});
+        }
+        work_available_.notify_one();
+    }
+
+    // Block until every task submitted for job has run; rethrow the first exception of its tasks
+    void WaitForJob(size_t job)
+    {
+        unique_lock<mutex> lock(job_mutex_);
+        job_done_.wait(lock, [&]()
+                       { return jobs_[job].pending == 0; });
+        if (jobs_[job].error)
+        {
+            exception_ptr error = jobs_[job].error;
+            jobs_[job].error = nullptr;
+            rethrow_exception(error);
+        }
+    }
+
+    // Utilization: busy time of the workers over their lifetime.
+    // Fairness: Jain's index of the busy time given to each job, 1 when all jobs got the same share.
+    void PrintMetrics()
+    {
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start_).count();
+        double busy = 0;
+        for (size_t w = 0; w < workers_.size(); ++w)
+        {
+            lock_guard<mutex> lock(workers_[w].tasks_mutex);
+            cout << "Worker #" << w << "\t\tTasks: " << workers_[w].task_count << "\t\tStolen: " << workers_[w].stolen_count
+                 << "\t\tBusy: " << workers_[w].busy_seconds << "s" << endl;
+            busy += workers_[w].busy_seconds;
+        }
+
+        lock_guard<mutex> lock(job_mutex_);
+        double share_sum = 0, share_sq_sum = 0;
+        for (const JobState &job : jobs_)
+        {
+            cout << "Job " << job.name << "\t\tTasks: " << job.task_count << "\t\tBusy: " << job.busy_seconds << "s\t\t"
+                 << "Average queueing delay: " << (job.task_count > 0 ? job.queued_seconds / job.task_count : 0) << "s" << endl;
+            share_sum += job.busy_seconds;
+            share_sq_sum += job.busy_seconds * job.busy_seconds;
+        }
+        double fairness = share_sq_sum > 0 ? share_sum * share_sum / (jobs_.size() * share_sq_sum) : 1;
+        cout << "Utilization: " << busy / (workers_.size() * elapsed) << "\t\tFairness: " << fairness << endl;
+    }
+
+private:
+    struct QueuedTask
+    {
+        size_t job;
+        Task run;
+        chrono::steady_clock::time_point submitted;
+    };
+
+    struct WorkerState
+    {
+        mutex tasks_mutex;
+        deque<QueuedTask> tasks;
+        size_t task_count = 0;
+        size_t stolen_count = 0;
+        double busy_seconds = 0;
+    };
+
+    struct JobState
+    {
+        string name;
+        size_t pending = 0;
+        size_t task_count = 0;
+        double busy_seconds = 0;
+        double queued_seconds = 0;
+        exception_ptr error;
+    };
+
+    // Own deque from the back, then the other deques from the front
+    bool PopTask(size_t w, QueuedTask &task, bool &stolen)
+    {
+        for (size_t k = 0; k < workers_.size(); ++k)
+        {
+            WorkerState &victim = workers_[(w + k) % workers_.size()];
+            lock_guard<mutex> lock(victim.tasks_mutex);
+            if (victim.tasks.empty())
+            {
+                continue;
+            }
+            if (k == 0)
+            {
+                task = move(victim.tasks.back());
+                victim.tasks.pop_back();
+            }
+            else
+            {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+            stolen = k != 0;
+            --queued_;
+            return true;
+        }
+        return false;
+    }
+
+    void RunWorker(size_t w)
+    {
+        current_worker_ = w;
+        GradientWorkspace workspace(context_);
+        while (true)
+        {
+            QueuedTask task;
+            bool stolen;
+            if (!PopTask(w, task, stolen))
+            {
+                unique_lock<mutex> lock(sleep_mutex_);
+                work_available_.wait(lock, [&]()
+                                     { return stopping_ || queued_ > 0; });
+                if (stopping_ && queued_ == 0)
+                {
+                    return;
+                }
+                continue;
+            }
+
+            auto start = chrono::steady_clock::now();
+            exception_ptr error;
+            try
+            {
+                task.run(workspace);
+            }
+            catch (...)
+            {
+                error = current_exception();
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            {
+                lock_guard<mutex> lock(workers_[w].tasks_mutex);
+                ++workers_[w].task_count;
+                workers_[w].stolen_count += stolen ? 1 : 0;
+                workers_[w].busy_seconds += seconds;
+            }
+            {
+                lock_guard<mutex> lock(job_mutex_);
+                JobState &job = jobs_[task.job];
+                ++job.task_count;
+                job.busy_seconds += seconds;
+                job.queued_seconds += chrono::duration<double>(start - task.submitted).count();
+                if (error && !job.error)
+                {
+                    job.error = error;
+                }
+                --job.pending;
+            }
+            job_done_.notify_all();
+        }
+    }
+
+    SEALContext &context_;
+    deque<WorkerState> workers_;
+    vector<thread> threads_;
+    chrono::steady_clock::time_point start_;
+
+    mutex sleep_mutex_;
+    condition_variable work_available_;
+    atomic<size_t> queued_{0};
+    bool stopping_ = false;
+    atomic<size_t> next_worker_{0};
+
+    mutex job_mutex_;
+    condition_variable job_done_;
+    deque<JobState> jobs_;
+
+    // Index of the worker running on this thread, if any
+    inline static thread_local size_t current_worker_ = size_t(-1);
+};
+
+// One Train iteration on label-packed samples as scheduler tasks:
+// a sigmoid task per block of block_size selected samples, then a reduction task that adds the block sums
+// and applies UpdateWeight. Return once the iteration's tasks have run.
+Ciphertext TrainScheduled(TaskScheduler &scheduler, size_t job, SEALContext &context, RelinKeys &relin_keys, double scale,
+                          const vector<Ciphertext> &encrypted_products, const vector<Ciphertext> &packed_samples, const Ciphertext &label_term,
+                          const Ciphertext &weight, const Ciphertext &learning_rate, const vector<double> &mask, size_t block_size)
+{
+    vector<size_t> selected;
+    for (size_t i = 0; i < mask.size(); ++i)
+    {
+        if (mask[i] != 0)
+        {
+            selected.push_back(i);
+        }
+    }
+
+    size_t block_count = (selected.size() + block_size - 1) / block_size;
+    vector<Ciphertext> block_sums(block_count);
+    for (size_t b = 0; b < block_count; ++b)
+    {
+        scheduler.Submit(job, [&, b](GradientWorkspace &workspace)
+                         {
+                             vector<double> block_mask(mask.size(), 0);
+                             for (size_t k = b * block_size; k < min(selected.size(), (b + 1) * block_size); ++k)
+                             {
+                                 block_mask[selected[k]] = 1;
+                             }
+                             block_sums[b] = SigmoidProductSum(context, relin_keys, scale, encrypted_products, packed_samples, block_mask, workspace);
+                         });
+    }
+    scheduler.WaitForJob(job);
+
+    Ciphertext trained_weight;
+    scheduler.Submit(job, [&](GradientWorkspace &workspace)
+                     {
+                         Ciphertext sigmoid_product_sum;
+                         workspace.evaluator.add_many(block_sums, sigmoid_product_sum);
+                         Ciphertext encrypted_derivatives_sum = SubtractFromLabelTerm(context, scale, label_term, sigmoid_product_sum);
+                         trained_weight = UpdateWeight(context, relin_keys, scale, encrypted_derivatives_sum, selected.size(), weight, learning_rate);
+                     });
+    scheduler.WaitForJob(job);
+    return trained_weight;
+}
+
+// Train one model per learning rate as concurrent jobs on one scheduler, then report the scheduler metrics.
+// Every job runs on its own thread but only submits tasks, including the encryption of its products.
+vector<vector<double>> TrainConcurrentJobs(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key,
+                                           RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale,
+                                           const vector<vector<double>> &features, const vector<double> &labels,
+                                           const vector<Ciphertext> &packed_samples, const vector<double> &initial_weights,
+                                           const vector<double> &learning_rates, size_t worker_count, size_t block_size, int max_iter)
+{
+    TaskScheduler scheduler(context, worker_count);
+    vector<double> mask(features.size(), 1);
+    Ciphertext label_term = LabelTerm(context, galois_keys, scale, packed_samples, mask, BlockSize(features[0].size()));
+
+    vector<vector<double>> weights(learning_rates.size(), initial_weights);
+    vector<exception_ptr> errors(learning_rates.size());
+    vector<thread> jobs;
+    for (size_t k = 0; k < learning_rates.size(); ++k)
+    {
+        jobs.emplace_back([&, k]()
+                          {
+                              // An exception must not leave the thread, or it terminates the program; it is rethrown after the join
+                              try
+                              {
+                                  stringstream name;
+                                  name << "lr=" << learning_rates[k];
+                                  size_t job = scheduler.CreateJob(name.str());
+
+                                  Plaintext plain_learning_rate;
+                                  Encode(encoder, learning_rates[k], scale, plain_learning_rate);
+                                  Ciphertext encrypted_learning_rate = Encrypt(context, public_key, scale, plain_learning_rate);
+
+                                  for (int iteration = 1; iteration <= max_iter; ++iteration)
+                                  {
+                                      vector<Ciphertext> encrypted_products(features.size());
+                                      for (size_t first = 0; first < features.size(); first += block_size)
+                                      {
+                                          scheduler.Submit(job, [&, first](GradientWorkspace &workspace)
+                                                           {
+                                                               for (size_t i = first; i < min(features.size(), first + block_size); ++i)
+                                                               {
+                                                                   Plaintext plain_product;
+                                                                   workspace.encoder.encode(PlainVectorMultiplication(features[i], weights[k]), scale, plain_product);
+                                                                   encrypted_products[i] = Encrypt(context, public_key, scale, plain_product);
+                                                               }
+                                                           });
+                                      }
+                                      Plaintext plain_weights;
+                                      Encode(encoder, weights[k], scale, plain_weights);
+                                      Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+                                      scheduler.WaitForJob(job);
+
+                                      Ciphertext encrypted_trained_weights = TrainScheduled(scheduler, job, context, relin_keys, scale, encrypted_products,
+                                                                                            packed_samples, label_term, encrypted_weights,
+                                                                                            encrypted_learning_rate, mask, block_size);
+                                      Plaintext plain_trained_weights = Decrypt(context, secret_key, encrypted_trained_weights);
+                                      Decode(encoder, plain_trained_weights, weights[k]);
+                                      weights[k].resize(features[0].size());
+                                  }
+                              }
+                              catch (...)
+                              {
+                                  errors[k] = current_exception();
+                              } });
+    }
+    for (size_t k = 0; k < jobs.size(); ++k)
+    {
+        jobs[k].join();
+    }
+    for (size_t k = 0; k < errors.size(); ++k)
+    {
+        if (errors[k])
+        {
+            rethrow_exception(errors[k]);
+        }
+    }
+
+    for (size_t k = 0; k < learning_rates.size(); ++k)
+    {
+        cout << "learning rate " << learning_rates[k] << "\ttrain accuracy: " << ComputeAccuracy(features, labels, weights[k]) << endl;
+    }
+    scheduler.PrintMetrics();
+    return weights;
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <future>
+#include <stdexcept>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "plain_algorithms.hpp"
+using namespace std;
+using namespace seal;
+
+// Out-of-core training: the encrypted dataset lives in a file of (sample, label) ciphertext pairs
+// and the products of an iteration in a file of one ciphertext per sample.
+// Train reads them back block by block, so memory is bounded by two blocks whatever the dataset size.
+
+// Data owner side: encrypt every (sample, label) pair and append it to the file without keeping it in memory.
+// record_offsets receives the file offset of every pair, so that a reader can seek to any sample.
+// Return the number of bytes written.
+streamoff WriteEncryptedDataset(string filename, SEALContext &context, CKKSEncoder &encoder, SecretKey &secret_key, double scale,
+                                vector<vector<double>> &features, vector<double> &labels, vector<streamoff> &record_offsets)
+{
+    fstream fout;
+    fout.open(filename, ios::out | ios::binary);
+    if (!fout.is_open())
+    {
+        throw runtime_error("cannot open " + filename);
+    }
+
+    streamoff written_bytes = 0;
+    record_offsets.clear();
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        record_offsets.push_back(written_bytes);
+
+        Plaintext plain_feature;
+        Encode(encoder, features[i], SampleParmsId(context), scale, plain_feature);
+        written_bytes += EncryptSymmetricToStream(context, secret_key, plain_feature, fout);
+
+        Plaintext plain_label;
+        Encode(encoder, labels[i], SampleParmsId(context), scale, plain_label);
+        written_bytes += EncryptSymmetricToStream(context, secret_key, plain_label, fout);
+    }
+    fout.close();
+    if (!fout)
+    {
+        throw runtime_error("cannot write " + filename);
+    }
+    return written_bytes;
+}
+
+streamoff WriteEncryptedDataset(string filename, SEALContext &context, CKKSEncoder &encoder, SecretKey &secret_key, double scale,
+                                vector<vector<double>> &features, vector<double> &labels)
+{
+    vector<streamoff> record_offsets;
+    return WriteEncryptedDataset(filename, context, encoder, secret_key, scale, features, labels, record_offsets);
+}
+
+// Encrypt the product of every sample with the current weights and append it to the file
+void WriteEncryptedProducts(string filename, SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, double scale,
+                            const vector<vector<double>> &features, const vector<double> &weights)
+{
+    fstream fout;
+    fout.open(filename, ios::out | ios::binary);
+    if (!fout.is_open())
+    {
+        throw runtime_error("cannot open " + filename);
+    }
+
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        double product = PlainVectorMultiplication(features[i], weights);
+        Plaintext plain_product;
+        Encode(encoder, product, scale, plain_product);
+        Encrypt(context, public_key, scale, plain_product).save(fout);
+    }
+    fout.close();
+    if (!fout)
+    {
+        throw runtime_error("cannot write " + filename);
+    }
+}
+
+struct EncryptedBlock
+{
+    vector<Ciphertext> products;
+    vector<Ciphertext> samples;
+    vector<Ciphertext> labels;
+};
+
+// Read the next block of at most block_size samples; the block is empty at the end of the files
+EncryptedBlock ReadEncryptedBlock(SEALContext &context, istream &dataset, istream &products, size_t block_size)
+{
+    EncryptedBlock block;
+    while (block.samples.size() < block_size && dataset.peek() != EOF)
+    {
+        block.samples.push_back(LoadCiphertext(context, dataset));
+        block.labels.push_back(LoadCiphertext(context, dataset));
+        block.products.push_back(LoadCiphertext(context, products));
+    }
+    return block;
+}
+
+// Same as Train(), but the samples, labels and products are streamed from files in blocks of block_size.
+// The next block is read on another thread while the evaluator works on the current one.
+// Throw if a file cannot be opened or the dataset holds no sample.
+Ciphertext TrainStreaming(SEALContext &context, RelinKeys &relin_keys, double scale, string dataset_filename, string products_filename,
+                          const Ciphertext &weight, const Ciphertext &learning_rate, size_t block_size)
+{
+    if (block_size == 0)
+    {
+        throw invalid_argument("block size must be positive");
+    }
+    Evaluator evaluator(context);
+
+    fstream dataset, products;
+    dataset.open(dataset_filename, ios::in | ios::binary);
+    if (!dataset.is_open())
+    {
+        throw runtime_error("cannot open " + dataset_filename);
+    }
+    products.open(products_filename, ios::in | ios::binary);
+    if (!products.is_open())
+    {
+        throw runtime_error("cannot open " + products_filename);
+    }
+
+    auto read_next_block = [&]()
+    { return ReadEncryptedBlock(context, dataset, products, block_size); };
+
+    GradientWorkspace workspace(context);
+    Ciphertext encrypted_derivatives_sum;
+    size_t sample_count = 0;
+    future<EncryptedBlock> next_block = async(launch::async, read_next_block);
+    while (true)
+    {
+        EncryptedBlock block = next_block.get();
+        if (block.samples.empty())
+        {
+            break;
+        }
+        // Prefetch the next block while this one is being processed
+        next_block = async(launch::async, read_next_block);
+
+        vector<double> mask(block.samples.size(), 1);
+        Ciphertext block_derivatives_sum = GradientSum(context, relin_keys, scale, block.products, block.samples, block.labels, mask, workspace);
+        if (sample_count == 0)
+        {
+            encrypted_derivatives_sum = block_derivatives_sum;
+        }
+        else
+        {
+            evaluator.add_inplace(encrypted_derivatives_sum, block_derivatives_sum);
+        }
+        sample_count += block.samples.size();
+    }
+    dataset.close();
+    products.close();
+    if (sample_count == 0)
+    {
+        throw runtime_error(dataset_filename + " holds no samples");
+    }
+
+    return UpdateWeight(context, relin_keys, scale, encrypted_derivatives_sum, sample_count, weight, learning_rate);
+}
+
+// Training loop of main() for the out-of-core mode.
+// The encrypted dataset is written once; every iteration rewrites the products file and streams both.
+vector<double> TrainOutOfCore(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key, RelinKeys &relin_keys,
+                              double scale, vector<vector<double>> &features, vector<double> &labels, vector<double> weights,
+                              double learning_rate, size_t block_size, int max_iter)
+{
+    string dataset_filename = "dataset/encrypted_dataset.bin";
+    string products_filename = "dataset/encrypted_products.bin";
+
+    streamoff dataset_bytes = WriteEncryptedDataset(dataset_filename, context, encoder, secret_key, scale, features, labels);
+    cout << "Encrypted dataset on disk: " << dataset_bytes / (1024 * 1024) << " MB" << endl;
+
+    Plaintext plain_learning_rate;
+    Encode(encoder, learning_rate, SampleParmsId(context), scale, plain_learning_rate);
+    Ciphertext encrypted_learning_rate = Encrypt(context, public_key, scale, plain_learning_rate);
+
+    for (int iteration = 1; iteration <= max_iter; ++iteration)
+    {
+        cout << "Iteration #" << iteration << "...\t\t";
+        WriteEncryptedProducts(products_filename, context, encoder, public_key, scale, features, weights);
+
+        Plaintext plain_weights;
+        Encode(encoder, weights, scale, plain_weights);
+        Ciphertext encrypted_weights = Encrypt(context, public_key, scale, plain_weights);
+
+        unsigned long iteration_start = clock();
+        Ciphertext encrypted_trained_weights = TrainStreaming(context, relin_keys, scale, dataset_filename, products_filename,
+                                                              encrypted_weights, encrypted_learning_rate, block_size);
+        unsigned long iteration_end = clock();
+
+        Plaintext plain_trained_weights = Decrypt(context, secret_key, encrypted_trained_weights);
+        Decode(encoder, plain_trained_weights, weights);
+        weights.resize(features[0].size());
+
+        cout << "Training time: " << (iteration_end - iteration_start) / CLOCKS_PER_SEC << "s\t\t";
+        cout << "Train accuracy: " << ComputeAccuracy(features, labels, weights) << endl;
+    }
+    return weights;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <iostream>
+#include <vector>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "packing.hpp"
+#include "block_models.hpp"
+#include "plain_algorithms.hpp"
+using namespace std;
+using namespace seal;
+
+// Train one model per learning rate in a single encrypted pass.
+// Model k owns block k of every ciphertext: the samples are replicated into all blocks,
+// while the weights, the products and the learning rate differ per block.
+// Return the weights of the model with the best train accuracy.
+vector<double> TrainLearningRateSweep(SEALContext &context, CKKSEncoder &encoder, PublicKey &public_key, SecretKey &secret_key,
+                                      RelinKeys &relin_keys, GaloisKeys &galois_keys, double scale,
+                                      const vector<vector<double>> &features, const vector<double> &labels,
+                                      const vector<double> &initial_weights, const vector<double> &learning_rates, int max_iter)
+{
+    size_t slot_count = encoder.slot_count();
+    size_t width = features[0].size();
+    size_t block_size = BlockSize(width);
+    size_t model_count = learning_rates.size();
+    if (block_size * model_count > slot_count)
+    {
+        throw invalid_argument("too many learning rates to fit in one ciphertext");
+    }
+
+    // Every block of a label holds the same label
+    vector<vector<double>> block_labels;
+    for (size_t i = 0; i < labels.size(); ++i)
+    {
+        block_labels.push_back(vector<double>(model_count, labels[i]));
+    }
+
+    vector<vector<double>> weights(model_count, initial_weights);
+    vector<double> best_weights = initial_weights;
+    double best_accuracy = 0;
+    size_t best_model = 0;
+    TrainBlockModels(context, encoder, public_key, secret_key, relin_keys, galois_keys, scale, features, block_labels, learning_rates,
+                     weights, max_iter, [&](const vector<vector<double>> &trained)
+                     {
+                         cout << endl;
+                         for (size_t k = 0; k < model_count; ++k)
+                         {
+                             double train_accuracy = ComputeAccuracy(features, labels, trained[k]);
+                             cout << "    learning rate " << learning_rates[k] << "\ttrain accuracy: " << train_accuracy << endl;
+                             if (train_accuracy > best_accuracy)
+                             {
+                                 best_accuracy = train_accuracy;
+                                 best_weights = trained[k];
+                                 best_model = k;
+                             }
+                         } });
+
+    cout << "Best learning rate: " << learning_rates[best_model] << endl;
+    cout << "Highest accuracy: " << best_accuracy << endl;
+    return best_weights;
+}
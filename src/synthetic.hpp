@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+using namespace std;
+
+// Synthetic logistic regression dataset in the layout of diabetes_normalized.csv:
+// feature_count features uniform in [0, 1] followed by a 0/1 label column.
+// Labels come from a random linear model plus logistic noise, thresholded so that
+// a positive_ratio fraction of the rows is positive.
+vector<vector<double>> GenerateDataset(size_t row_count, size_t feature_count, double positive_ratio, unsigned int seed)
+{
+    if (row_count == 0)
+    {
+        throw invalid_argument("a synthetic dataset needs at least one row");
+    }
+    if (!(positive_ratio >= 0 && positive_ratio <= 1))
+    {
+        throw invalid_argument("the positive ratio must be between 0 and 1");
+    }
+    mt19937 generator(seed);
+    uniform_real_distribution<double> feature_distribution(0, 1);
+    normal_distribution<double> weight_distribution(0, 4);
+    uniform_real_distribution<double> noise_distribution(1e-9, 1 - 1e-9);
+
+    vector<double> true_weights(feature_count);
+    for (size_t j = 0; j < feature_count; ++j)
+    {
+        true_weights[j] = weight_distribution(generator);
+    }
+
+    vector<vector<double>> dataset(row_count, vector<double>(feature_count + 1));
+    vector<double> scores(row_count);
+    for (size_t i = 0; i < row_count; ++i)
+    {
+        double score = 0;
+        for (size_t j = 0; j < feature_count; ++j)
+        {
+            dataset[i][j] = feature_distribution(generator);
+            score += dataset[i][j] * true_weights[j];
+        }
+        // logistic noise
+        double u = noise_distribution(generator);
+        scores[i] = score + log(u / (1 - u));
+    }
+
+    // The rows above the (1 - positive_ratio) quantile are positive
+    vector<double> sorted_scores = scores;
+    size_t negative_count = min(row_count - 1, size_t((1 - positive_ratio) * row_count));
+    nth_element(sorted_scores.begin(), sorted_scores.begin() + negative_count, sorted_scores.end());
+    double threshold = sorted_scores[negative_count];
+    for (size_t i = 0; i < row_count; ++i)
+    {
+        dataset[i][feature_count] = scores[i] >= threshold ? 1 : 0;
+    }
+    return dataset;
+}
+
+vector<string> SyntheticHeader(size_t feature_count)
+{
+    vector<string> header;
+    for (size_t j = 0; j < feature_count; ++j)
+    {
+        header.push_back("x" + to_string(j + 1));
+    }
+    header.push_back("Outcome");
+    return header;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "seal/seal.h"
+#include "homomorphic.hpp"
+#include "checkpoint.hpp"
+using namespace std;
+using namespace seal;
+
+// Transport format of the ciphertexts that go over the wire or to disk:
+//     magic, compression mode, parms_id, payload (Ciphertext::save)
+// A ciphertext carries every prime of its level, but its consumer may only need the lower ones, so the writer
+// mod-switches it to the consumer's level first. Of the compression modes this SEAL build supports, the payload
+// keeps whichever encodes it smaller. The reader checks the parms_id against the level it expects.
+
+const char TRANSPORT_MAGIC[4] = {'H', 'E', 'T', 'P'};
+
+// zstd and zlib, when SEAL was built with them
+vector<compr_mode_type> TransportComprModes()
+{
+    vector<compr_mode_type> modes;
+    for (compr_mode_type mode : {compr_mode_type::zstd, compr_mode_type::zlib})
+    {
+        if (Serialization::IsSupportedComprMode(mode))
+        {
+            modes.push_back(mode);
+        }
+    }
+    if (modes.empty())
+    {
+        modes.push_back(compr_mode_type::none);
+    }
+    return modes;
+}
+
+// Write ciphertext for a consumer that works at consumer_parms_id, which must not be above the level of ciphertext.
+// Return the number of bytes written.
+streamoff SaveTransport(SEALContext &context, const Ciphertext &ciphertext, parms_id_type consumer_parms_id, ostream &out)
+{
+    const Ciphertext *payload_ciphertext = &ciphertext;
+    Ciphertext dropped;
+    if (ciphertext.parms_id() != consumer_parms_id)
+    {
+        Evaluator evaluator(context);
+        evaluator.mod_switch_to(ciphertext, consumer_parms_id, dropped);
+        payload_ciphertext = &dropped;
+    }
+
+    string payload;
+    compr_mode_type payload_compr_mode = compr_mode_type::none;
+    for (compr_mode_type compr_mode : TransportComprModes())
+    {
+        stringstream encoding;
+        payload_ciphertext->save(encoding, compr_mode);
+        string bytes = encoding.str();
+        if (payload.empty() || bytes.size() < payload.size())
+        {
+            payload = move(bytes);
+            payload_compr_mode = compr_mode;
+        }
+    }
+
+    out.write(TRANSPORT_MAGIC, sizeof(TRANSPORT_MAGIC));
+    WriteValue(out, static_cast<uint8_t>(payload_compr_mode));
+    WriteValue(out, consumer_parms_id);
+    out.write(payload.data(), payload.size());
+    return sizeof(TRANSPORT_MAGIC) + sizeof(uint8_t) + sizeof(parms_id_type) + payload.size();
+}
+
+// Read back a ciphertext written by SaveTransport; throw if it is not at expected_parms_id
+Ciphertext LoadTransport(SEALContext &context, istream &in, parms_id_type expected_parms_id)
+{
+    char magic[sizeof(TRANSPORT_MAGIC)];
+    uint8_t compr_mode;
+    parms_id_type parms_id;
+    in.read(magic, sizeof(magic));
+    ReadValue(in, compr_mode);
+    ReadValue(in, parms_id);
+    if (!in || !equal(magic, magic + sizeof(magic), TRANSPORT_MAGIC))
+    {
+        throw runtime_error("not a transport ciphertext");
+    }
+    if (parms_id != expected_parms_id)
+    {
+        throw runtime_error("transport ciphertext is not at the level of its consumer");
+    }
+    if (!Serialization::IsSupportedComprMode(static_cast<compr_mode_type>(compr_mode)))
+    {
+        throw runtime_error("transport ciphertext uses a compression mode this build does not support");
+    }
+
+    Ciphertext ciphertext = LoadCiphertext(context, in);
+    if (ciphertext.parms_id() != parms_id)
+    {
+        throw runtime_error("transport header does not match its ciphertext");
+    }
+    return ciphertext;
+}